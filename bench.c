@@ -0,0 +1,272 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <time.h>
+
+#include "bench.h"
+#include "compiler.h"
+#include "intern.h"
+#include "memory.h"
+#include "scanner.h"
+#include "vm.h"
+
+typedef struct {
+    int      runs;
+    double   minMs;
+    double   medianMs;
+    double   p99Ms;
+    uint64_t instructions; // Per run.
+    long     peakRssKb;
+} BenchResult;
+
+static double nowMs() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec * 1e3 + now.tv_nsec / 1e6;
+}
+
+static int compareTimes(const void* a, const void* b) {
+    double timeA = *(const double*)a;
+    double timeB = *(const double*)b;
+    return (timeA > timeB) - (timeA < timeB);
+}
+
+/* The nearest-rank percentile of the sorted `times`. */
+static double percentile(double* times, int count, double fraction) {
+    int rank = (int)(fraction * count);
+    if (rank < fraction * count || rank < 1) rank++;
+    return times[rank - 1];
+}
+
+static void writeJsonString(FILE* file, const char* string) {
+    fputc('"', file);
+    for (const char* c = string; *c != '\0'; c++) {
+        if (*c == '"' || *c == '\\') fputc('\\', file);
+        fputc(*c, file);
+    }
+    fputc('"', file);
+}
+
+static void writeReport(FILE* file, const char* path, BenchResult* result) {
+    fprintf(file, "{\n  \"script\": ");
+    writeJsonString(file, path);
+    fprintf(file, ",\n"
+                  "  \"runs\": %d,\n"
+                  "  \"min_ms\": %.3f,\n"
+                  "  \"median_ms\": %.3f,\n"
+                  "  \"p99_ms\": %.3f,\n"
+                  "  \"instructions\": %llu,\n"
+                  "  \"peak_rss_kb\": %ld\n"
+                  "}\n",
+            result->runs, result->minMs, result->medianMs, result->p99Ms,
+            (unsigned long long)result->instructions, result->peakRssKb);
+}
+
+/* Find `"key": <number>` in a report we wrote earlier. This is not a
+ * general JSON parser; it only has to read our own output back. */
+static bool readMetric(const char* json, const char* key, double* value) {
+    char pattern[64];
+    snprintf(pattern, sizeof(pattern), "\"%s\":", key);
+
+    const char* found = strstr(json, pattern);
+    if (found == NULL) return false;
+
+    char* end;
+    *value = strtod(found + strlen(pattern), &end);
+    return end != found + strlen(pattern);
+}
+
+static char* readWholeFile(const char* path) {
+    FILE* file = fopen(path, "rb");
+    if (file == NULL) return NULL;
+
+    fseek(file, 0L, SEEK_END);
+    long size = ftell(file);
+    rewind(file);
+
+    char* buffer = malloc(size + 1);
+    if (buffer != NULL) {
+        buffer[fread(buffer, 1, size, file)] = '\0';
+    }
+    fclose(file);
+    return buffer;
+}
+
+static void compareLine(const char* json, const char* key, double current) {
+    double baseline;
+    if (!readMetric(json, key, &baseline)) {
+        fprintf(stderr, "%-14s %14s %14.3f\n", key, "-", current);
+        return;
+    }
+
+    fprintf(stderr, "%-14s %14.3f %14.3f", key, baseline, current);
+    if (baseline != 0) {
+        fprintf(stderr, " %+8.1f%%", (current - baseline) / baseline * 100);
+    }
+    fprintf(stderr, "\n");
+}
+
+/* Print each metric next to the one in the baseline report, with the
+ * relative change. Negative is better for all of them. */
+static void compareReport(const char* baselinePath, BenchResult* result) {
+    char* json = readWholeFile(baselinePath);
+    if (json == NULL) {
+        fprintf(stderr, "Could not read baseline \"%s\".\n", baselinePath);
+        return;
+    }
+
+    fprintf(stderr, "== compared with %s ==\n", baselinePath);
+    fprintf(stderr, "%-14s %14s %14s %9s\n",
+            "metric", "baseline", "current", "change");
+    compareLine(json, "min_ms", result->minMs);
+    compareLine(json, "median_ms", result->medianMs);
+    compareLine(json, "p99_ms", result->p99Ms);
+    compareLine(json, "instructions", (double)result->instructions);
+    compareLine(json, "peak_rss_kb", (double)result->peakRssKb);
+
+    free(json);
+}
+
+/* Run `source` `options->repeat` times on the current VM and report
+ * the wall time of each run (compile included), the instructions
+ * each run executed and the process's peak memory.
+ *
+ * Globals and interned strings carry over from run to run, as they
+ * would in a long-lived embedding, so the first run can be slower. */
+InterpretResult runRepeated(const char* path, const char* source,
+                            BenchOptions* options) {
+    double* times = ALLOCATE(double, options->repeat);
+
+    BenchResult result = {0};
+    InterpretResult status = INTERPRET_OK;
+    for (int i = 0; i < options->repeat; i++) {
+        uint64_t instructions = vm.instructionCount;
+        double   start        = nowMs();
+
+        status = options->stream ? interpretStream(source)
+                                 : interpret(source);
+
+        times[i] = nowMs() - start;
+        result.instructions = vm.instructionCount - instructions;
+        result.runs++;
+        if (status != INTERPRET_OK) break;
+    }
+
+    qsort(times, result.runs, sizeof(double), compareTimes);
+    result.minMs    = times[0];
+    result.medianMs = percentile(times, result.runs, 0.5);
+    result.p99Ms    = percentile(times, result.runs, 0.99);
+    FREE_ARRAY(double, times, options->repeat);
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    result.peakRssKb = usage.ru_maxrss; // Kilobytes on Linux.
+
+    FILE* report = stderr;
+    if (options->reportPath != NULL) {
+        report = fopen(options->reportPath, "w");
+        if (report == NULL) {
+            fprintf(stderr, "Could not write report \"%s\".\n",
+                    options->reportPath);
+            report = stderr;
+        }
+    }
+    writeReport(report, path, &result);
+    if (report != stderr) fclose(report);
+
+    if (options->comparePath != NULL) {
+        compareReport(options->comparePath, &result);
+    }
+
+    return status;
+}
+
+/* Time the scanner on its own over `source`, returning the number of
+ * tokens (EOF included). */
+static int scanAll(const char* source, double* ms) {
+    double start  = nowMs();
+    int    tokens = 0;
+    initScanner(source);
+    for (;;) {
+        tokens++;
+        if (scanToken().type == TOKEN_EOF) break;
+    }
+    *ms = nowMs() - start;
+    return tokens;
+}
+
+static double perSecond(double count, double ms) {
+    return ms > 0 ? count / ms * 1e3 : 0;
+}
+
+/* Compile `source` without running it (--compile-only). With `timings`
+ * also report where the time went and what came out (--timings).
+ *
+ * Scanning and parsing are interleaved in compile(), so the scanner is
+ * first timed in a pass of its own, and parsing plus emitting is what
+ * compile() takes on top of that. */
+InterpretResult compileOnly(const char* path, const char* source,
+                            bool timings) {
+    if (!timings) {
+        return compile(source) == NULL ? INTERPRET_COMPILE_ERROR
+                                       : INTERPRET_OK;
+    }
+
+    size_t length = strlen(source);
+    double scanMs;
+    int    tokens = scanAll(source, &scanMs);
+
+    // Counted where strings are made, since most repeats are found in
+    // vm.strings and never reach the intern table.
+    int      oldStrings = internCount();
+    uint64_t oldLookups = stringLookups;
+    uint64_t oldHits    = stringLocalHits;
+    Obj*     oldObjects = vm.objects;
+
+    double       start    = nowMs();
+    ObjFunction* function = compile(source);
+    double       totalMs  = nowMs() - start;
+
+    int created = internCount() - oldStrings;
+    int lookups = (int)(stringLookups - oldLookups);
+    int local   = (int)(stringLocalHits - oldHits);
+
+    // Everything compile() made is on the object list ahead of what
+    // was there before.
+    int    functions = 0;
+    size_t code      = 0;
+    size_t lineTable = 0;
+    int    constants = 0;
+    for (Obj* object = vm.objects; object != oldObjects;
+            object = object->next) {
+        if (object->type != OBJ_FUNCTION) continue;
+        Chunk* chunk = &((ObjFunction*)object)->chunk;
+        functions++;
+        code      += chunk->count;
+        lineTable += sizeof(int) * chunk->count;
+        constants += chunk->constants.count;
+    }
+
+    double parseMs = totalMs - scanMs;
+    if (parseMs < 0) parseMs = 0;
+
+    fprintf(stderr, "== compile timings: %s ==\n", path);
+    fprintf(stderr, "%-13s %10s  %s\n", "phase", "ms", "throughput");
+    fprintf(stderr, "%-13s %10.3f  %.2f M tokens/s, %.1f MB/s of source\n",
+            "scan", scanMs, perSecond(tokens, scanMs) / 1e6,
+            perSecond(length, scanMs) / 1e6);
+    fprintf(stderr, "%-13s %10.3f  %.1f MB/s of bytecode\n",
+            "parse + emit", parseMs, perSecond(code, parseMs) / 1e6);
+    fprintf(stderr, "%-13s %10.3f  %.1f MB/s of source\n",
+            "compile", totalMs, perSecond(length, totalMs) / 1e6);
+    fprintf(stderr, "source        %zu bytes, %d tokens\n", length, tokens);
+    fprintf(stderr, "interning     %d lookups, %d new strings, %d reused "
+                    "(%d from vm.strings)\n",
+            lookups, created, lookups - created, local);
+    fprintf(stderr, "output        %d functions, %zu bytes of code, "
+                    "%d constants, %zu bytes of line table\n",
+            functions, code, constants, lineTable);
+
+    return function == NULL ? INTERPRET_COMPILE_ERROR : INTERPRET_OK;
+}
@@ -0,0 +1,20 @@
+#ifndef clox_bench_h
+#define clox_bench_h
+
+#include "common.h"
+#include "vm.h"
+
+/* Options for running one script many times over (--repeat). */
+typedef struct {
+    int         repeat;
+    bool        stream;      // Run each time with interpretStream.
+    const char* reportPath;  // Where the JSON report goes; NULL for stderr.
+    const char* comparePath; // A saved report to compare against, or NULL.
+} BenchOptions;
+
+InterpretResult runRepeated(const char* path, const char* source,
+                            BenchOptions* options);
+InterpretResult compileOnly(const char* path, const char* source,
+                            bool timings);
+
+#endif
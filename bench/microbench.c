@@ -0,0 +1,707 @@
+/* Microbenchmarks for the hashtable, string interning, string hashing,
+ * the allocator, keyword scanning and embedded expressions, driven
+ * directly from C rather than through Lox.
+ *
+ * Built by `make microbench` against the interpreter's own objects,
+ * compiled with PROBE_STATS so table.c and intern.c count their probes.
+ *
+ * Usage: microbench [--keys N,N...] [--length L,L...]
+ *                   [--delete-ratio R,R...] [--rounds N]
+ *                   [--latency-keys N]
+ *
+ * Every combination of key count, key length and delete ratio is run.
+ * Each benchmark is timed `rounds` times and the fastest round kept.
+ * internCopy and tableSet latency are measured per call while growing
+ * the intern table and a table by `--latency-keys` keys (0 to skip).
+ * Then hashString's distribution is checked against a uniform hash's,
+ * and the exit status is 1 if it collides far more often. */
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "common.h"
+#include "embed.h"
+#include "intern.h"
+#include "memory.h"
+#include "object.h"
+#include "scanner.h"
+#include "table.h"
+#include "vm.h"
+
+#define MAX_LIST 16
+
+typedef struct {
+    int    values[MAX_LIST];
+    int    count;
+} IntList;
+
+typedef struct {
+    double values[MAX_LIST];
+    int    count;
+} RatioList;
+
+static int rounds = 5;
+
+static double nowNs() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec * 1e9 + now.tv_nsec;
+}
+
+static uint64_t rngState = 0x9E3779B97F4A7C15ull;
+
+static uint64_t nextRandom() {
+    rngState ^= rngState << 13;
+    rngState ^= rngState >> 7;
+    rngState ^= rngState << 17;
+    return rngState;
+}
+
+static const char digits[] =
+    "0123456789abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ";
+
+static int writeBase62(char* buffer, int n) {
+    int length = 0;
+    do {
+        buffer[length++] = digits[n % 62];
+        n /= 62;
+    } while (n > 0);
+    return length;
+}
+
+/* `count` keys of `length` characters each (or a little longer, if
+ * that's too short to keep them distinct), none of which any earlier
+ * call returned. The front of each key is the number of the key set
+ * and the key's index, and the rest is random letters. */
+static char** makeKeys(int count, int length) {
+    static int keySets = 0;
+    int set = keySets++;
+
+    char** keys = malloc(sizeof(char*) * count);
+    for (int i = 0; i < count; i++) {
+        char prefix[32];
+        int  prefixLength = writeBase62(prefix, set);
+        prefix[prefixLength++] = '_';
+        prefixLength += writeBase62(prefix + prefixLength, i);
+
+        int keyLength = length > prefixLength ? length : prefixLength;
+        keys[i] = malloc(keyLength + 1);
+        memcpy(keys[i], prefix, prefixLength);
+        for (int c = prefixLength; c < keyLength; c++) {
+            keys[i][c] = digits[10 + nextRandom() % 52];
+        }
+        keys[i][keyLength] = '\0';
+    }
+    return keys;
+}
+
+static void freeKeys(char** keys, int count) {
+    for (int i = 0; i < count; i++) free(keys[i]);
+    free(keys);
+}
+
+static ObjString** internKeys(char** keys, int count) {
+    ObjString** strings = malloc(sizeof(ObjString*) * count);
+    for (int i = 0; i < count; i++) {
+        strings[i] = copyString(keys[i], (int)strlen(keys[i]));
+    }
+    return strings;
+}
+
+/* Measurements for one benchmark, accumulated over a round. */
+typedef struct {
+    double   best;    // Fastest round, in ns.
+    uint64_t probes;  // Probes in that round.
+    int      ops;     // Operations per round.
+} Timing;
+
+static void startTiming(Timing* timing, int ops) {
+    timing->best   = -1;
+    timing->probes = 0;
+    timing->ops    = ops;
+}
+
+static double roundStart;
+static uint64_t probeStart;
+
+static void beginRound() {
+    probeStart = tableProbes + internProbes;
+    roundStart = nowNs();
+}
+
+static void endRound(Timing* timing) {
+    double   elapsed = nowNs() - roundStart;
+    uint64_t probes  = tableProbes + internProbes - probeStart;
+    if (timing->best < 0 || elapsed < timing->best) {
+        timing->best   = elapsed;
+        timing->probes = probes;
+    }
+}
+
+static void report(const char* name, int keys, int length, double ratio,
+                   Timing* timing) {
+    printf("%-22s %9d %6d %6.2f %10.1f %10.2f\n", name, keys, length,
+           ratio, timing->best / timing->ops,
+           (double)timing->probes / timing->ops);
+}
+
+// Keeps results alive so the compiler can't drop the work.
+static volatile uint64_t sink;
+
+/* The byte-at-a-time hash hashString replaced, to compare against. */
+static uint32_t fnv1a(const char* key, int length) {
+    uint32_t hash = 2166136261u;
+    for (int i = 0; i < length; i++) {
+        hash ^= (uint8_t)key[i];
+        hash *= 16777619;
+    }
+    return hash;
+}
+
+static void benchHash(char** keys, int count, int length) {
+    Timing timing;
+    startTiming(&timing, count);
+    for (int r = 0; r < rounds; r++) {
+        uint64_t total = 0;
+        beginRound();
+        for (int i = 0; i < count; i++) {
+            total += hashString(keys[i], (int)strlen(keys[i]));
+        }
+        endRound(&timing);
+        sink = total;
+    }
+    report("hashString", count, length, 0, &timing);
+
+    startTiming(&timing, count);
+    for (int r = 0; r < rounds; r++) {
+        uint64_t total = 0;
+        beginRound();
+        for (int i = 0; i < count; i++) {
+            total += fnv1a(keys[i], (int)strlen(keys[i]));
+        }
+        endRound(&timing);
+        sink = total;
+    }
+    report("FNV-1a", count, length, 0, &timing);
+}
+
+static int compareHashes(const void* a, const void* b) {
+    uint32_t hashA = *(const uint32_t*)a;
+    uint32_t hashB = *(const uint32_t*)b;
+    return (hashA > hashB) - (hashA < hashB);
+}
+
+/* Keys that collide with an earlier one in `hashes`, which is sorted
+ * and has been masked or shifted down to the bits being checked. */
+static int countCollisions(uint32_t* hashes, int count) {
+    qsort(hashes, count, sizeof(uint32_t), compareHashes);
+    int collisions = 0;
+    for (int i = 1; i < count; i++) {
+        if (hashes[i] == hashes[i - 1]) collisions++;
+    }
+    return collisions;
+}
+
+/* Hash `keys` into 2^bits buckets, by the low bits (as tables and
+ * intern stripes pick a slot) and by the high ones, and compare the
+ * collisions with what a uniform hash would give. Also counts full
+ * 32-bit collisions. Returns false if there are far too many. */
+static bool checkHash(const char* name, char** keys, int count,
+                      int length) {
+    int bits = 1;
+    while ((1 << bits) < count) bits++;
+    double buckets  = (double)(1 << bits);
+    double expected = count - buckets * (1 - pow(1 - 1 / buckets, count));
+    double full     = (double)count * (count - 1) / 2 / 4294967296.0;
+    double limit    = expected * 1.05 + 4 * sqrt(expected) + 1;
+
+    uint32_t* hashes = malloc(sizeof(uint32_t) * count);
+    uint32_t* low    = malloc(sizeof(uint32_t) * count);
+    uint32_t* high   = malloc(sizeof(uint32_t) * count);
+    for (int i = 0; i < count; i++) {
+        hashes[i] = hashString(keys[i], (int)strlen(keys[i]));
+        low[i]    = hashes[i] & ((1u << bits) - 1);
+        high[i]   = hashes[i] >> (32 - bits);
+    }
+    int lowCollisions  = countCollisions(low, count);
+    int highCollisions = countCollisions(high, count);
+    int fullCollisions = countCollisions(hashes, count);
+    free(hashes);
+    free(low);
+    free(high);
+
+    bool ok = lowCollisions <= limit && highCollisions <= limit &&
+              fullCollisions <= full + 4 * sqrt(full) + 2;
+    printf("%-10s %9d %6d %8d %10.1f %8d %8d %6.1f %6d  %s\n", name,
+           count, length, 1 << bits, expected, lowCollisions,
+           highCollisions, full, fullCollisions, ok ? "ok" : "FAIL");
+    return ok;
+}
+
+/* "ident_0", "ident_1"... padded with x's to `length`: the sort of
+ * near-identical names real scripts are full of. */
+static char** makeSequentialKeys(int count, int length) {
+    char** keys = malloc(sizeof(char*) * count);
+    for (int i = 0; i < count; i++) {
+        char name[32];
+        int  nameLength = snprintf(name, sizeof(name), "ident_%d", i);
+        int  keyLength  = length > nameLength ? length : nameLength;
+        keys[i] = malloc(keyLength + 1);
+        memcpy(keys[i], name, nameLength);
+        memset(keys[i] + nameLength, 'x', keyLength - nameLength);
+        keys[i][keyLength] = '\0';
+    }
+    return keys;
+}
+
+/* copyString of strings that are all new, then of the same strings
+ * again (all already interned), then takeString of heap copies of
+ * them, which frees each copy. Interning never forgets, so the "new"
+ * case uses a fresh key set each round. */
+static void benchIntern(int count, int length) {
+    Timing fresh;
+    startTiming(&fresh, count);
+    char** keys = NULL;
+    for (int r = 0; r < rounds; r++) {
+        if (keys != NULL) freeKeys(keys, count);
+        keys = makeKeys(count, length);
+
+        beginRound();
+        for (int i = 0; i < count; i++) {
+            sink += (uintptr_t)copyString(keys[i], (int)strlen(keys[i]));
+        }
+        endRound(&fresh);
+    }
+    report("copyString (new)", count, length, 0, &fresh);
+
+    Timing hit;
+    startTiming(&hit, count);
+    for (int r = 0; r < rounds; r++) {
+        beginRound();
+        for (int i = 0; i < count; i++) {
+            sink += (uintptr_t)copyString(keys[i], (int)strlen(keys[i]));
+        }
+        endRound(&hit);
+    }
+    report("copyString (interned)", count, length, 0, &hit);
+
+    Timing take;
+    startTiming(&take, count);
+    for (int r = 0; r < rounds; r++) {
+        // The copies are made outside the timed loop.
+        char** copies = malloc(sizeof(char*) * count);
+        for (int i = 0; i < count; i++) {
+            int keyLength = (int)strlen(keys[i]);
+            copies[i] = ALLOCATE(char, keyLength + 1);
+            memcpy(copies[i], keys[i], keyLength + 1);
+        }
+
+        beginRound();
+        for (int i = 0; i < count; i++) {
+            sink += (uintptr_t)takeString(copies[i], (int)strlen(keys[i]));
+        }
+        endRound(&take);
+        free(copies);
+    }
+    report("takeString (interned)", count, length, 0, &take);
+
+    freeKeys(keys, count);
+}
+
+static void benchTable(char** keys, int count, int length, double ratio) {
+    ObjString** present = internKeys(keys, count);
+    char**      missingKeys = makeKeys(count, length);
+    ObjString** missing = internKeys(missingKeys, count);
+    int deletes = (int)(count * ratio);
+
+    Timing set, get, miss, del, getAfter, find;
+    startTiming(&set, count);
+    startTiming(&get, count);
+    startTiming(&miss, count);
+    startTiming(&del, deletes > 0 ? deletes : 1);
+    startTiming(&getAfter, count);
+    startTiming(&find, count);
+
+    for (int r = 0; r < rounds; r++) {
+        Table table;
+        initTable(&table);
+
+        beginRound();
+        for (int i = 0; i < count; i++) {
+            tableSet(&table, present[i], NUMBER_VAL(i));
+        }
+        endRound(&set);
+
+        Value value;
+        beginRound();
+        for (int i = 0; i < count; i++) {
+            sink += tableGet(&table, present[i], &value);
+        }
+        endRound(&get);
+
+        beginRound();
+        for (int i = 0; i < count; i++) {
+            sink += tableGet(&table, missing[i], &value);
+        }
+        endRound(&miss);
+
+        beginRound();
+        for (int i = 0; i < count; i++) {
+            sink += (uintptr_t)tableFindString(&table, keys[i],
+                                               present[i]->length,
+                                               present[i]->hash);
+        }
+        endRound(&find);
+
+        // Delete every n-th key so the tombstones are spread out.
+        beginRound();
+        for (int i = 0; i < deletes; i++) {
+            int index = (int)((int64_t)i * count / deletes);
+            sink += tableDelete(&table, present[index]);
+        }
+        endRound(&del);
+
+        beginRound();
+        for (int i = 0; i < count; i++) {
+            sink += tableGet(&table, present[i], &value);
+        }
+        endRound(&getAfter);
+
+        freeTable(&table);
+    }
+
+    report("tableSet (insert)", count, length, ratio, &set);
+    report("tableGet (hit)", count, length, ratio, &get);
+    report("tableGet (miss)", count, length, ratio, &miss);
+    report("tableFindString", count, length, ratio, &find);
+    if (deletes > 0) {
+        report("tableDelete", count, length, ratio, &del);
+        report("tableGet (after del)", count, length, ratio, &getAfter);
+    }
+
+    free(present);
+    free(missing);
+    freeKeys(missingKeys, count);
+}
+
+static int compareDoubles(const void* a, const void* b) {
+    double x = *(const double*)a;
+    double y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+/* Sort `count` call times and print them as percentiles. */
+static void reportLatency(const char* name, double* times, int count) {
+    double total = 0;
+    for (int i = 0; i < count; i++) total += times[i];
+
+    qsort(times, count, sizeof(double), compareDoubles);
+    printf("%-22s %9d %7.0fns %7.0fns %7.0fns %7.0fns %7.0fns\n",
+           name, count, total / count, times[(int)(count * 0.50)],
+           times[(int)(count * 0.99)], times[(int)(count * 0.9999)],
+           times[count - 1]);
+}
+
+/* The latency of each internCopy while the intern table grows by
+ * `count` new strings, and of each tableSet while a table grows to
+ * `count` keys, timed one call at a time, as percentiles. Tables are
+ * grown with resizes done in one go and then incrementally, where the
+ * tail is what matters. Intern stripes always grow incrementally. */
+static void benchSetLatency(int count) {
+    char**      keys    = makeKeys(count, 16);
+    ObjString** strings = malloc(sizeof(ObjString*) * count);
+    double*     times   = malloc(sizeof(double) * count);
+
+    printf("\n%-22s %9s %9s %9s %9s %9s %9s\n", "latency",
+           "keys", "mean", "p50", "p99", "p99.99", "max");
+
+    // Straight to the shared table, without vm.strings in the way.
+    for (int i = 0; i < count; i++) {
+        int      length = (int)strlen(keys[i]);
+        uint32_t hash   = hashString(keys[i], length);
+        double   start  = nowNs();
+        strings[i] = internCopy(keys[i], length, hash);
+        times[i]   = nowNs() - start;
+    }
+    reportLatency("internCopy (new)", times, count);
+
+    for (int incremental = 0; incremental <= 1; incremental++) {
+        Table table;
+        initTable(&table);
+        table.incremental = incremental;
+
+        for (int i = 0; i < count; i++) {
+            double start = nowNs();
+            tableSet(&table, strings[i], NUMBER_VAL(i));
+            times[i] = nowNs() - start;
+        }
+        freeTable(&table);
+
+        reportLatency(incremental ? "tableSet (incremental)"
+                                  : "tableSet (one-shot)", times, count);
+    }
+
+    for (int i = 0; i < count; i++) internRelease(strings[i]);
+    free(times);
+    free(strings);
+    freeKeys(keys, count);
+}
+
+/* reallocate: allocate `length`-byte blocks, grow each to twice its
+ * size, then free them, as chunk and table arrays do. */
+static void benchReallocate(int count, int length) {
+    void** blocks = malloc(sizeof(void*) * count);
+
+    Timing timing;
+    startTiming(&timing, count * 3);
+    for (int r = 0; r < rounds; r++) {
+        beginRound();
+        for (int i = 0; i < count; i++) {
+            blocks[i] = reallocate(NULL, 0, length);
+        }
+        for (int i = 0; i < count; i++) {
+            blocks[i] = reallocate(blocks[i], length, length * 2);
+        }
+        for (int i = 0; i < count; i++) {
+            reallocate(blocks[i], length * 2, 0);
+        }
+        endRound(&timing);
+    }
+    report("reallocate", count, length, 0, &timing);
+
+    free(blocks);
+}
+
+/* Words for identifier-heavy sources: every keyword, and identifiers
+ * that share a length, a first letter or a prefix with one, which a
+ * keyword recognizer has to tell apart from it. */
+static const char* keywordWords[] = {
+    "and", "class", "else", "false", "for", "fun", "if", "nil", "or",
+    "print", "return", "super", "this", "true", "var", "while",
+};
+static const char* nearWords[] = {
+    "an", "ands", "classy", "elsewhere", "falsey", "fo", "form", "fund",
+    "i", "iff", "nill", "orb", "printer", "returns", "sup", "thistle",
+    "truth", "va", "vary", "whilst", "count", "total", "node", "left",
+};
+
+/* A source of `count` words, `keywordShare` of them keywords, the
+ * rest identifiers from nearWords or made up. */
+static char* makeIdentifierSource(int count, double keywordShare) {
+    int   keywordCount = sizeof(keywordWords) / sizeof(keywordWords[0]);
+    int   nearCount    = sizeof(nearWords) / sizeof(nearWords[0]);
+    char* source       = malloc((size_t)count * 16 + 1);
+    char* out          = source;
+
+    for (int i = 0; i < count; i++) {
+        double pick = (double)(nextRandom() % 1000) / 1000;
+        if (pick < keywordShare) {
+            out += sprintf(out, "%s", keywordWords[nextRandom() %
+                                                   keywordCount]);
+        } else if (nextRandom() % 2 == 0) {
+            out += sprintf(out, "%s", nearWords[nextRandom() % nearCount]);
+        } else {
+            int length = 1 + (int)(nextRandom() % 10);
+            for (int c = 0; c < length; c++) {
+                *out++ = digits[10 + nextRandom() % 52];
+            }
+        }
+        *out++ = i % 8 == 7 ? '\n' : ' ';
+    }
+    *out = '\0';
+    return source;
+}
+
+/* scanToken over identifier-heavy sources, per token. This is where
+ * the keyword recognizer (keywords.h) is most of the work. */
+static void benchScanner(int count) {
+    static const struct {
+        const char* name;
+        double      keywordShare;
+    } mixes[] = {
+        {"scan (keywords)", 1.0},
+        {"scan (mixed)", 0.3},
+        {"scan (identifiers)", 0.0},
+    };
+
+    for (int m = 0; m < 3; m++) {
+        char* source = makeIdentifierSource(count, mixes[m].keywordShare);
+
+        Timing timing;
+        startTiming(&timing, count);
+        for (int r = 0; r < rounds; r++) {
+            uint64_t total = 0;
+            initScanner(source);
+            beginRound();
+            for (;;) {
+                Token token = scanToken();
+                if (token.type == TOKEN_EOF) break;
+                total += token.type;
+            }
+            endRound(&timing);
+            sink = total;
+        }
+        report(mixes[m].name, count, 0, 0, &timing);
+        free(source);
+    }
+}
+
+/* A small rule evaluated with fresh inputs each time: through an
+ * Expression, then by setting globals and interpreting the source
+ * again, which is what embedding it took before. */
+static void benchExpression(int count) {
+    static const char* source = "price * qty > 100 and qty != 0";
+    const char* names[] = {"price", "qty"};
+
+    Expression* rule  = newExpression(source, names, 2);
+    int         price = expressionInput(rule, "price");
+    int         qty   = expressionInput(rule, "qty");
+
+    Timing evaluated;
+    startTiming(&evaluated, count);
+    for (int r = 0; r < rounds; r++) {
+        Value result;
+        beginRound();
+        for (int i = 0; i < count; i++) {
+            bindInput(rule, price, NUMBER_VAL(i % 50));
+            bindInput(rule, qty, NUMBER_VAL(i % 7));
+            evaluate(rule, &result);
+            sink += AS_BOOL(result);
+        }
+        endRound(&evaluated);
+    }
+    report("evaluate", count, 0, 0, &evaluated);
+    freeExpression(rule);
+
+    // Every interpret() compiles a new function, so only do a few.
+    int interpretCount = count < 1000 ? count : 1000;
+    char script[64];
+    snprintf(script, sizeof(script), "%s;", source);
+    ObjString* priceName = copyString("price", 5);
+    ObjString* qtyName   = copyString("qty", 3);
+
+    Timing interpreted;
+    startTiming(&interpreted, interpretCount);
+    for (int r = 0; r < rounds; r++) {
+        beginRound();
+        for (int i = 0; i < interpretCount; i++) {
+            tableSet(&vm.globals, priceName, NUMBER_VAL(i % 50));
+            tableSet(&vm.globals, qtyName, NUMBER_VAL(i % 7));
+            sink += interpret(script);
+        }
+        endRound(&interpreted);
+    }
+    report("interpret (recompile)", interpretCount, 0, 0, &interpreted);
+    resetVM();
+}
+
+static void usage();
+
+/* Parse a comma-separated list like "1000,100000". */
+static void parseInts(const char* arg, IntList* list) {
+    list->count = 0;
+    for (const char* p = arg; list->count < MAX_LIST; p++) {
+        char* end;
+        list->values[list->count++] = (int)strtol(p, &end, 10);
+        if (end == p || list->values[list->count - 1] < 1) usage();
+        if (*end != ',') break;
+        p = end;
+    }
+}
+
+static void parseRatios(const char* arg, RatioList* list) {
+    list->count = 0;
+    for (const char* p = arg; list->count < MAX_LIST; p++) {
+        char* end;
+        double ratio = strtod(p, &end);
+        if (end == p || ratio < 0 || ratio > 1) usage();
+        list->values[list->count++] = ratio;
+        if (*end != ',') break;
+        p = end;
+    }
+}
+
+static void usage() {
+    fprintf(stderr,
+            "Usage: microbench [--keys N,N...] [--length L,L...]\n"
+            "                  [--delete-ratio R,R...] [--rounds N]\n"
+            "                  [--latency-keys N]\n");
+    exit(64);
+}
+
+int main(int argc, const char* argv[]) {
+    IntList   keyCounts   = {{1000, 100000}, 2};
+    IntList   lengths     = {{8, 32}, 2};
+    RatioList ratios      = {{0.25}, 1};
+    int       latencyKeys = 1000000;
+
+    for (int i = 1; i < argc; i++) {
+        if (i + 1 >= argc) usage();
+        if (strcmp(argv[i], "--keys") == 0) {
+            parseInts(argv[++i], &keyCounts);
+        } else if (strcmp(argv[i], "--length") == 0) {
+            parseInts(argv[++i], &lengths);
+        } else if (strcmp(argv[i], "--delete-ratio") == 0) {
+            parseRatios(argv[++i], &ratios);
+        } else if (strcmp(argv[i], "--latency-keys") == 0) {
+            latencyKeys = atoi(argv[++i]);
+            if (latencyKeys < 0) usage();
+        } else if (strcmp(argv[i], "--rounds") == 0) {
+            rounds = atoi(argv[++i]);
+            if (rounds < 1) usage();
+        } else {
+            usage();
+        }
+    }
+
+    // Strings are objects, so they need a VM to belong to.
+    initVM();
+
+    printf("%-22s %9s %6s %6s %10s %10s\n",
+           "benchmark", "keys", "length", "delete", "ns/op", "probes/op");
+    for (int k = 0; k < keyCounts.count; k++) {
+        for (int l = 0; l < lengths.count; l++) {
+            int    count  = keyCounts.values[k];
+            int    length = lengths.values[l];
+            char** keys   = makeKeys(count, length);
+
+            benchHash(keys, count, length);
+            benchIntern(count, length);
+            for (int d = 0; d < ratios.count; d++) {
+                benchTable(keys, count, length, ratios.values[d]);
+            }
+            benchReallocate(count, length);
+
+            freeKeys(keys, count);
+        }
+        benchScanner(keyCounts.values[k]);
+        benchExpression(keyCounts.values[k]);
+    }
+
+    if (latencyKeys > 0) benchSetLatency(latencyKeys);
+
+    // Distribution checks, for random and for sequential names.
+    printf("\n%-10s %9s %6s %8s %10s %8s %8s %6s %6s\n", "keys", "count",
+           "length", "buckets", "expected", "low", "high", "32-bit",
+           "found");
+    bool hashOk = true;
+    for (int k = 0; k < keyCounts.count; k++) {
+        for (int l = 0; l < lengths.count; l++) {
+            int    count  = keyCounts.values[k];
+            int    length = lengths.values[l];
+            char** keys   = makeKeys(count, length);
+            hashOk &= checkHash("random", keys, count, length);
+            freeKeys(keys, count);
+
+            keys = makeSequentialKeys(count, length);
+            hashOk &= checkHash("sequential", keys, count, length);
+            freeKeys(keys, count);
+        }
+    }
+
+    freeVM();
+    freeInternTable();
+    return hashOk ? 0 : 1;
+}
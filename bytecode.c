@@ -0,0 +1,461 @@
+#include <string.h>
+
+#include "bytecode.h"
+#include "memory.h"
+#include "vm.h"
+
+// Constant tags.
+#define TAG_NIL      0
+#define TAG_FALSE    1
+#define TAG_TRUE     2
+#define TAG_NUMBER   3
+#define TAG_STRING   4
+#define TAG_FUNCTION 5
+
+// Name length of an unnamed (top-level) function.
+#define NO_NAME 0xFFFFFFFFu
+
+// How deeply function constants may nest inside one another.
+#define MAX_NESTING 256
+
+// Stack slots one call may use: FRAMES_MAX frames of this many fill
+// the VM's stack exactly.
+#define FRAME_SLOTS (STACK_MAX / FRAMES_MAX)
+
+typedef struct {
+    uint8_t* bytes;
+    size_t   count;
+    size_t   capacity;
+} Writer;
+
+static void writeBytes(Writer* writer, const void* bytes, size_t length) {
+    if (writer->count + length > writer->capacity) {
+        size_t oldCapacity = writer->capacity;
+        while (writer->capacity < writer->count + length) {
+            writer->capacity = GROW_CAPACITY(writer->capacity);
+        }
+        writer->bytes = GROW_ARRAY(uint8_t, writer->bytes, oldCapacity,
+                                   writer->capacity);
+    }
+    memcpy(writer->bytes + writer->count, bytes, length);
+    writer->count += length;
+}
+
+static void writeU8(Writer* writer, uint8_t value) {
+    writeBytes(writer, &value, 1);
+}
+
+static void writeU32(Writer* writer, uint32_t value) {
+    uint8_t bytes[4] = {value, value >> 8, value >> 16, value >> 24};
+    writeBytes(writer, bytes, 4);
+}
+
+static void writeString(Writer* writer, ObjString* string) {
+    if (string == NULL) {
+        writeU32(writer, NO_NAME);
+        return;
+    }
+    writeU32(writer, (uint32_t)string->length);
+    writeBytes(writer, string->chars, string->length);
+}
+
+static void writeFunction(Writer* writer, ObjFunction* function);
+
+static void writeConstant(Writer* writer, Value value) {
+    switch (value.type) {
+        case VAL_NIL:  writeU8(writer, TAG_NIL); break;
+        case VAL_BOOL:
+            writeU8(writer, AS_BOOL(value) ? TAG_TRUE : TAG_FALSE);
+            break;
+        case VAL_NUMBER: {
+            uint64_t bits;
+            double number = AS_NUMBER(value);
+            memcpy(&bits, &number, sizeof(bits));
+            writeU8(writer, TAG_NUMBER);
+            writeU32(writer, (uint32_t)bits);
+            writeU32(writer, (uint32_t)(bits >> 32));
+            break;
+        }
+        case VAL_OBJ:
+            // The compiler only makes string and function constants.
+            if (IS_FUNCTION(value)) {
+                writeU8(writer, TAG_FUNCTION);
+                writeFunction(writer, AS_FUNCTION(value));
+            } else {
+                writeU8(writer, TAG_STRING);
+                writeString(writer, AS_STRING(value));
+            }
+            break;
+    }
+}
+
+static void writeFunction(Writer* writer, ObjFunction* function) {
+    Chunk* chunk = &function->chunk;
+
+    writeU8(writer, (uint8_t)function->arity);
+    writeString(writer, function->name);
+
+    writeU32(writer, (uint32_t)chunk->count);
+    writeBytes(writer, chunk->code, chunk->count);
+    for (int i = 0; i < chunk->count; i++) {
+        writeU32(writer, (uint32_t)chunk->lines[i]);
+    }
+
+    writeU32(writer, (uint32_t)chunk->constants.count);
+    for (int i = 0; i < chunk->constants.count; i++) {
+        writeConstant(writer, chunk->constants.values[i]);
+    }
+
+    writeU32(writer, (uint32_t)chunk->loopCount);
+    for (int i = 0; i < chunk->loopCount; i++) {
+        writeU32(writer, (uint32_t)chunk->loops[i].header);
+    }
+    writeU32(writer, (uint32_t)chunk->cacheCount);
+}
+
+/* Serialize a compiled script. The result is owned by the caller, who
+ * frees it with FREE_ARRAY(uint8_t, bytes, *length). */
+uint8_t* writeBytecode(ObjFunction* function, size_t* length) {
+    Writer writer = {NULL, 0, 0};
+    writeBytes(&writer, BYTECODE_MAGIC, 4);
+    writeU8(&writer, BYTECODE_VERSION);
+    writeFunction(&writer, function);
+
+    // Hand back an allocation of exactly the right size.
+    writer.bytes = GROW_ARRAY(uint8_t, writer.bytes, writer.capacity,
+                              writer.count);
+    *length = writer.count;
+    return writer.bytes;
+}
+
+typedef struct {
+    const uint8_t* current;
+    const uint8_t* end;
+    bool           failed;
+} Reader;
+
+static bool have(Reader* reader, size_t length) {
+    if (reader->failed || (size_t)(reader->end - reader->current) < length) {
+        reader->failed = true;
+        return false;
+    }
+    return true;
+}
+
+static uint8_t readU8(Reader* reader) {
+    if (!have(reader, 1)) return 0;
+    return *reader->current++;
+}
+
+static uint32_t readU32(Reader* reader) {
+    if (!have(reader, 4)) return 0;
+    const uint8_t* bytes = reader->current;
+    reader->current += 4;
+    return (uint32_t)bytes[0] | (uint32_t)bytes[1] << 8 |
+           (uint32_t)bytes[2] << 16 | (uint32_t)bytes[3] << 24;
+}
+
+static ObjString* readString(Reader* reader) {
+    uint32_t length = readU32(reader);
+    if (length == NO_NAME || !have(reader, length)) return NULL;
+
+    ObjString* string = copyString((const char*)reader->current,
+                                   (int)length);
+    reader->current += length;
+    return string;
+}
+
+static ObjFunction* readFunction(Reader* reader, int depth);
+
+static Value readConstant(Reader* reader, int depth) {
+    switch (readU8(reader)) {
+        case TAG_NIL:   return NIL_VAL;
+        case TAG_FALSE: return BOOL_VAL(false);
+        case TAG_TRUE:  return BOOL_VAL(true);
+        case TAG_NUMBER: {
+            uint64_t bits = readU32(reader);
+            bits |= (uint64_t)readU32(reader) << 32;
+            double number;
+            memcpy(&number, &bits, sizeof(number));
+            return NUMBER_VAL(number);
+        }
+        case TAG_STRING: {
+            ObjString* string = readString(reader);
+            if (string != NULL) return OBJ_VAL(string);
+            break;
+        }
+        case TAG_FUNCTION: {
+            ObjFunction* function = readFunction(reader, depth + 1);
+            if (function != NULL) return OBJ_VAL(function);
+            break;
+        }
+    }
+
+    reader->failed = true;
+    return NIL_VAL;
+}
+
+/* The length of an instruction with its operands, or 0 if `opcode`
+ * isn't one. */
+static int instructionLength(uint8_t opcode) {
+    switch (opcode) {
+        case OP_CONSTANT:
+        case OP_POPN:
+        case OP_GET_LOCAL:
+        case OP_SET_LOCAL:
+        case OP_GET_GLOBAL:
+        case OP_DEFINE_GLOBAL:
+        case OP_SET_GLOBAL:
+        case OP_CALL:
+        case OP_CLASS:
+            return 2;
+        case OP_JUMP:
+        case OP_JUMP_IF_FALSE:
+            return 3;
+        case OP_GET_PROPERTY:
+        case OP_SET_PROPERTY:
+            return 4;
+        case OP_LOOP:
+            return 5;
+        default:
+            return opcode <= OP_DIVIDE_NUM ? 1 : 0;
+    }
+}
+
+static bool isName(Chunk* chunk, uint8_t constant) {
+    return constant < chunk->constants.count &&
+           IS_STRING(chunk->constants.values[constant]);
+}
+
+// Stack heights while verifying, for offsets with no height yet.
+#define NOT_AN_INSTRUCTION -2
+#define UNREACHED          -1
+
+/* Record that the instruction at `target` is reached with `height`
+ * values on the stack, queueing it the first time. Every path to an
+ * instruction must agree on its height. */
+static bool flowTo(int* heights, int* pending, int* pendingCount,
+                   int count, int target, int height) {
+    if (target < 0 || target >= count) return false;
+    if (heights[target] == UNREACHED) {
+        heights[target] = height;
+        pending[(*pendingCount)++] = target;
+        return true;
+    }
+    return heights[target] == height;
+}
+
+/* Check that `function` is safe to run, since nothing in the VM
+ * checks its operands: every instruction is one the VM knows, with
+ * its operands all there; the constants, caches and loops it names
+ * exist; jumps land on instructions; and on every path the stack
+ * stays within the function's window and its share of the VM's
+ * stack, and the code ends in a return rather than running off the
+ * end.
+ *
+ * Paths are followed like the VM would, tracking only how many values
+ * are on the stack, so each instruction is looked at once. */
+static bool verifyFunction(ObjFunction* function) {
+    Chunk*   chunk = &function->chunk;
+    uint8_t* code  = chunk->code;
+    int      count = chunk->count;
+    if (count == 0) return false;
+
+    int* heights = ALLOCATE(int, count);
+    int* pending = ALLOCATE(int, count);
+    int  pendingCount = 0;
+    bool valid = true;
+
+    // Find where instructions start: the VM rewrites opcodes as it
+    // quickens them, so no jump may land in an operand.
+    for (int offset = 0; offset < count; offset++) {
+        heights[offset] = NOT_AN_INSTRUCTION;
+    }
+    for (int offset = 0; valid && offset < count; ) {
+        int length = instructionLength(code[offset]);
+        if (length == 0 || length > count - offset) {
+            valid = false;
+        } else {
+            heights[offset] = UNREACHED;
+            offset += length;
+        }
+    }
+
+    // The function itself and its arguments are there on entry.
+    heights[0] = function->arity + 1;
+    pending[pendingCount++] = 0;
+
+    while (valid && pendingCount > 0) {
+        int      offset   = pending[--pendingCount];
+        int      height   = heights[offset];
+        uint8_t* operands = &code[offset + 1];
+        int      next     = offset + instructionLength(code[offset]);
+        int      branch   = -1;
+        int      pops     = 0;
+        int      pushes   = 0;
+
+        switch (code[offset]) {
+            case OP_CONSTANT:
+                valid  = operands[0] < chunk->constants.count;
+                pushes = 1;
+                break;
+            case OP_NIL:
+            case OP_TRUE:
+            case OP_FALSE:
+                pushes = 1;
+                break;
+            case OP_POP:   pops = 1;           break;
+            case OP_POPN:  pops = operands[0]; break;
+            case OP_GET_LOCAL:
+                valid  = operands[0] < height;
+                pushes = 1;
+                break;
+            case OP_SET_LOCAL:
+                valid = operands[0] < height;
+                pops  = pushes = 1;
+                break;
+            case OP_GET_GLOBAL:
+            case OP_CLASS:
+                valid  = isName(chunk, operands[0]);
+                pushes = 1;
+                break;
+            case OP_DEFINE_GLOBAL:
+                valid = isName(chunk, operands[0]);
+                pops  = 1;
+                break;
+            case OP_SET_GLOBAL:
+                valid = isName(chunk, operands[0]);
+                pops  = pushes = 1;
+                break;
+            case OP_GET_PROPERTY:
+            case OP_SET_PROPERTY: {
+                int cache = operands[1] << 8 | operands[2];
+                valid  = isName(chunk, operands[0]) &&
+                         cache < chunk->cacheCount;
+                pops   = code[offset] == OP_GET_PROPERTY ? 1 : 2;
+                pushes = 1;
+                break;
+            }
+            case OP_NOT:
+            case OP_NEGATE:
+                pops = pushes = 1;
+                break;
+            case OP_PRINT: pops = 1; break;
+            case OP_JUMP:
+                next += operands[0] << 8 | operands[1];
+                break;
+            case OP_JUMP_IF_FALSE:
+                branch = next + (operands[0] << 8 | operands[1]);
+                pops   = pushes = 1;
+                break;
+            case OP_LOOP: {
+                uint16_t loop = (uint16_t)(operands[2] << 8 | operands[3]);
+                valid = loop == LOOP_UNCOUNTED || loop < chunk->loopCount;
+                next  = offset + 3 - (operands[0] << 8 | operands[1]);
+                break;
+            }
+            case OP_CALL:
+                pops   = operands[0] + 1;
+                pushes = 1;
+                break;
+            case OP_RETURN:
+                pops = 1;
+                next = -1;
+                break;
+            default:
+                // The binary operators, generic and quickened.
+                pops   = 2;
+                pushes = 1;
+                break;
+        }
+
+        if (height < pops) valid = false;
+        height += pushes - pops;
+        if (height > FRAME_SLOTS) valid = false;
+        if (!valid) break;
+
+        if (next != -1) {
+            valid = flowTo(heights, pending, &pendingCount, count,
+                           next, height);
+        }
+        if (valid && branch != -1) {
+            valid = flowTo(heights, pending, &pendingCount, count,
+                           branch, height);
+        }
+    }
+
+    FREE_ARRAY(int, heights, count);
+    FREE_ARRAY(int, pending, count);
+    return valid && pendingCount == 0;
+}
+
+static ObjFunction* readFunction(Reader* reader, int depth) {
+    if (depth > MAX_NESTING) return NULL;
+
+    ObjFunction* function = newFunction();
+    Chunk*       chunk    = &function->chunk;
+
+    function->arity = readU8(reader);
+    uint32_t nameLength = readU32(reader);
+    if (nameLength != NO_NAME) {
+        if (!have(reader, nameLength)) return NULL;
+        function->name = copyString((const char*)reader->current,
+                                    (int)nameLength);
+        reader->current += nameLength;
+    }
+
+    uint32_t count = readU32(reader);
+    // Each byte of code also has a four-byte line number.
+    if (!have(reader, (size_t)count * 5)) return NULL;
+    const uint8_t* code = reader->current;
+    reader->current += count;
+    for (uint32_t i = 0; i < count; i++) {
+        writeChunk(chunk, code[i], (int)readU32(reader));
+    }
+
+    uint32_t constants = readU32(reader);
+    for (uint32_t i = 0; i < constants && !reader->failed; i++) {
+        addConstant(chunk, readConstant(reader, depth));
+    }
+
+    // No more loops than OP_LOOP can name, each with a header in the
+    // code.
+    uint32_t loops = readU32(reader);
+    if (loops > LOOP_UNCOUNTED) return NULL;
+    for (uint32_t i = 0; i < loops && !reader->failed; i++) {
+        uint32_t header = readU32(reader);
+        if (header >= count) return NULL;
+        addLoop(chunk, (int)header);
+    }
+
+    // Caches take up no bytes, so this is all that limits them.
+    uint32_t caches = readU32(reader);
+    if (caches > UINT16_MAX + 1u) return NULL;
+    for (uint32_t i = 0; i < caches && !reader->failed; i++) {
+        addPropertyCache(chunk);
+    }
+
+    if (reader->failed || !verifyFunction(function)) return NULL;
+    return function;
+}
+
+/* Load a script written by writeBytecode, or return NULL if `bytes`
+ * isn't one. Any functions created before a failure are left to be
+ * freed with the VM's other objects. */
+ObjFunction* readBytecode(const uint8_t* bytes, size_t length) {
+    Reader reader = {bytes, bytes + length, false};
+
+    if (!have(&reader, 5) || memcmp(bytes, BYTECODE_MAGIC, 4) != 0 ||
+            bytes[4] != BYTECODE_VERSION) {
+        return NULL;
+    }
+    reader.current += 5;
+
+    // The script is run with no arguments.
+    ObjFunction* function = readFunction(&reader, 0);
+    if (function == NULL || function->arity != 0 ||
+            reader.current != reader.end) {
+        return NULL;
+    }
+    return function;
+}
@@ -0,0 +1,25 @@
+#ifndef clox_bytecode_h
+#define clox_bytecode_h
+
+#include "common.h"
+#include "object.h"
+
+/* Compiled scripts as bytes, so they can be compiled in one place and
+ * run in another (e.g. sent to a `--serve` daemon).
+ *
+ * The format is a magic number and version followed by the script
+ * function. A function is its arity, name, code, line numbers and
+ * constants, where a constant may itself be a function. Type feedback,
+ * loop counts and inline caches start out empty when read back.
+ *
+ * Multi-byte integers are little-endian. Reading checks the structure
+ * and verifies the code of every function (see verifyFunction), so
+ * bytecode from anywhere, a `--serve` client included, can't take the
+ * VM outside its chunks or its stack. */
+#define BYTECODE_MAGIC   "LOXB"
+#define BYTECODE_VERSION 2
+
+uint8_t*     writeBytecode(ObjFunction* function, size_t* length);
+ObjFunction* readBytecode(const uint8_t* bytes, size_t length);
+
+#endif
@@ -9,17 +9,37 @@ void initChunk(Chunk* chunk) {
     chunk->capacity = 0;
     chunk->code     = NULL;
     chunk->lines    = NULL;
+    chunk->feedback = NULL;
+
+    chunk->loopCount    = 0;
+    chunk->loopCapacity = 0;
+    chunk->loops        = NULL;
+
+    chunk->cacheCount    = 0;
+    chunk->cacheCapacity = 0;
+    chunk->caches        = NULL;
     
     initValueArray(&(chunk->constants));
 }
 
 void freeChunk(Chunk* chunk) {
     FREE_ARRAY(uint8_t, chunk->code, chunk->capacity);
-    FREE_ARRAY(uint8_t, chunk->lines, chunk->capacity);
+    FREE_ARRAY(int, chunk->lines, chunk->capacity);
+    FREE_ARRAY(uint8_t, chunk->feedback, chunk->capacity);
     freeValueArray(&chunk->constants);
+    FREE_ARRAY(LoopCounter, chunk->loops, chunk->loopCapacity);
+    FREE_ARRAY(PropertyCache, chunk->caches, chunk->cacheCapacity);
     initChunk(chunk);
 }
 
+/* Empty a chunk for reuse, keeping its allocations. */
+void resetChunk(Chunk* chunk) {
+    chunk->count = 0;
+    chunk->constants.count = 0;
+    chunk->loopCount = 0;
+    chunk->cacheCount = 0;
+}
+
 void writeChunk(Chunk* chunk, uint8_t byte, int line) {
     if (chunk->capacity < chunk->count + 1) {
         int oldCapacity = chunk->capacity;
@@ -36,10 +56,17 @@ void writeChunk(Chunk* chunk, uint8_t byte, int line) {
             oldCapacity,
             chunk->capacity
         );
+        chunk->feedback = GROW_ARRAY(
+            uint8_t,
+            chunk->feedback,
+            oldCapacity,
+            chunk->capacity
+        );
     }
 
-    chunk->code[chunk->count]  = byte;
-    chunk->lines[chunk->count] = line;
+    chunk->code[chunk->count]     = byte;
+    chunk->lines[chunk->count]    = line;
+    chunk->feedback[chunk->count] = 0;
     ++chunk->count;
 }
 
@@ -49,3 +76,45 @@ int addConstant(Chunk* chunk, Value value) {
     writeValueArray(&chunk->constants, value);
     return chunk->constants.count - 1;
 }
+
+
+/* Register a loop whose header starts at offset `header`, returning
+the index its OP_LOOP refers to it by. */
+int addLoop(Chunk* chunk, int header) {
+    if (chunk->loopCapacity < chunk->loopCount + 1) {
+        int oldCapacity = chunk->loopCapacity;
+        chunk->loopCapacity = GROW_CAPACITY(oldCapacity);
+        chunk->loops = GROW_ARRAY(
+            LoopCounter,
+            chunk->loops,
+            oldCapacity,
+            chunk->loopCapacity
+        );
+    }
+
+    LoopCounter* loop = &chunk->loops[chunk->loopCount];
+    loop->header = header;
+    loop->count  = 0;
+    return chunk->loopCount++;
+}
+
+/* Add an empty inline cache, returning the index a property
+instruction refers to it by. */
+int addPropertyCache(Chunk* chunk) {
+    if (chunk->cacheCapacity < chunk->cacheCount + 1) {
+        int oldCapacity = chunk->cacheCapacity;
+        chunk->cacheCapacity = GROW_CAPACITY(oldCapacity);
+        chunk->caches = GROW_ARRAY(
+            PropertyCache,
+            chunk->caches,
+            oldCapacity,
+            chunk->cacheCapacity
+        );
+    }
+
+    PropertyCache* cache = &chunk->caches[chunk->cacheCount];
+    cache->shape      = NULL;
+    cache->transition = NULL;
+    cache->slot       = 0;
+    return chunk->cacheCount++;
+}
\ No newline at end of file
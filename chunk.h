@@ -10,8 +10,14 @@ typedef enum {
     OP_TRUE,
     OP_FALSE,
     OP_POP,
+    OP_POPN,
+    OP_GET_LOCAL,
+    OP_SET_LOCAL,
     OP_GET_GLOBAL,
     OP_DEFINE_GLOBAL,
+    OP_SET_GLOBAL,
+    OP_GET_PROPERTY,
+    OP_SET_PROPERTY,
     OP_EQUAL,
     OP_GREATER, 
     OP_LESS,
@@ -22,20 +28,88 @@ typedef enum {
     OP_NOT,
     OP_NEGATE,
     OP_PRINT,
+    OP_JUMP,
+    OP_JUMP_IF_FALSE,
+    OP_LOOP,
+    OP_CALL,
+    OP_CLASS,
     OP_RETURN,
+
+    // Quickened forms of the arithmetic and comparison instructions.
+    // The VM rewrites a generic instruction into one of these once it
+    // has seen number operands, and back again if that stops holding.
+    OP_GREATER_NUM,
+    OP_LESS_NUM,
+    OP_ADD_NUM,
+    OP_SUBTRACT_NUM,
+    OP_MULTIPLY_NUM,
+    OP_DIVIDE_NUM,
 } OpCode;
 
+/* Type feedback recorded per arithmetic instruction: the kinds of
+ * operands it has seen, and in the top bits how many times it has
+ * been deoptimised. */
+#define FEEDBACK_NUMBERS 0x01
+#define FEEDBACK_STRINGS 0x02
+#define FEEDBACK_OTHER   0x04
+
+#define FEEDBACK_DEOPT_SHIFT 4
+#define FEEDBACK_DEOPTS(feedback) ((feedback) >> FEEDBACK_DEOPT_SHIFT)
+
+// An instruction deoptimised this often stays generic.
+#define FEEDBACK_MAX_DEOPTS 4
+
+/* A loop in a chunk: where its header starts, and how many times its
+ * back edge has been taken. OP_LOOP names its loop by index into the
+ * chunk's `loops`. */
+typedef struct {
+    int      header;
+    uint64_t count;
+} LoopCounter;
+
+// A loop that has gone round this often counts as hot.
+#define LOOP_HOT_THRESHOLD 1000
+
+// OP_LOOP operand for a backward jump that isn't a loop's back edge.
+#define LOOP_UNCOUNTED UINT16_MAX
+
+struct Shape;
+
+/* Inline cache for one property access site. OP_GET_PROPERTY and
+ * OP_SET_PROPERTY name theirs by index into the chunk's `caches`.
+ *
+ * It remembers the shape last seen at the site and the slot the field
+ * is in for that shape. A set that added the field also remembers the
+ * shape the instance moved to. */
+typedef struct {
+    struct Shape* shape;
+    struct Shape* transition;
+    int           slot;
+} PropertyCache;
+
 typedef struct {
     int        count;
     int        capacity;
     uint8_t*   code;
     int*       lines;
+    uint8_t*   feedback; // One byte per byte of code.
     ValueArray constants;
+
+    int          loopCount;
+    int          loopCapacity;
+    LoopCounter* loops;
+
+    int            cacheCount;
+    int            cacheCapacity;
+    PropertyCache* caches;
 } Chunk;
 
 void initChunk(Chunk* chunk);
 void freeChunk(Chunk* chunk);
+void resetChunk(Chunk* chunk);
 void writeChunk(Chunk* chunk, uint8_t byte, int line);
 int  addConstant(Chunk* chunk, Value value);
+int  addLoop(Chunk* chunk, int header);
+int  addPropertyCache(Chunk* chunk);
 
 #endif
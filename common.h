@@ -5,7 +5,12 @@
 #include <stddef.h>
 #include <stdint.h>
 
+#define UINT8_COUNT (UINT8_MAX + 1)
+
+// Release builds (-DNDEBUG, e.g. for benchmarks) leave these out.
+#ifndef NDEBUG
 #define DEBUG_PRINT_CODE
 #define DEBUG_TRACE_EXECUTION
+#endif
 
 #endif
\ No newline at end of file
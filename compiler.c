@@ -1,9 +1,13 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "common.h"
 #include "compiler.h"
+#include "number.h"
+#include "scanahead.h"
 #include "scanner.h"
+#include "trace.h"
 
 #ifdef DEBUG_PRINT_CODE
 #include "debug.h"
@@ -14,6 +18,7 @@ typedef struct {
     Token previous;
     bool  hadError;
     bool  panicMode;
+    bool  scanAhead; // Tokens come from a scanner thread.
 } Parser;
 
 
@@ -47,8 +52,9 @@ typedef enum {
     PREC_PRIMARY,
 } Precedence;
 
-// Type of a function which takes no args, and returns void.
-typedef void (*ParseFn)();
+// Type of a parse function. `canAssign` says whether an `=` after
+// the expression may be treated as assignment.
+typedef void (*ParseFn)(bool canAssign);
 
 /* Row in parser table containing:
     1. The function to compile a prefix expression beginning with a
@@ -64,13 +70,41 @@ typedef struct {
     Precedence precedence;
 } ParseRule;
 
-/* Singleton parser instance */
-Parser parser;
+/* A local variable: its name, and the depth of the block that
+   declared it. A depth of -1 means declared but not yet defined. */
+typedef struct {
+    Token name;
+    int   depth;
+} Local;
+
+typedef enum {
+    TYPE_FUNCTION,
+    TYPE_SCRIPT,
+} FunctionType;
+
+/* State for compiling one function, chained to the compiler of the
+   function it's nested in.
+
+   `locals` mirrors the function's stack window. Locals live in the
+   window's slots in the order they were declared, so a local's index
+   in `locals` is its slot at runtime. */
+typedef struct Compiler {
+    struct Compiler* enclosing;
+    ObjFunction*     function;
+    FunctionType     type;
+
+    Local locals[UINT8_COUNT];
+    int   localCount;
+    int   scopeDepth;
+} Compiler;
 
-Chunk* compilingChunk;
+/* Singleton parser instance (per thread) */
+_Thread_local Parser parser;
+
+_Thread_local Compiler* current = NULL;
 
 static Chunk* currentChunk() {
-    return compilingChunk;
+    return &current->function->chunk;
 }
 
 static void errorAt(Token* token, const char* message) {
@@ -79,17 +113,17 @@ static void errorAt(Token* token, const char* message) {
     if (parser.panicMode) return;
     parser.panicMode = true;
 
-    fprintf(stderr, "[line %d] Error", token->line);
+    fprintf(vm.errors, "[line %d] Error", token->line);
 
     if (token->type == TOKEN_EOF) {
-        fprintf(stderr, " at end");
+        fprintf(vm.errors, " at end");
     } else if (token->type == TOKEN_ERROR) {
         // Nothing.
     } else {
-        fprintf(stderr, " at '%.*s'", token->length, token->start);
+        fprintf(vm.errors, " at '%.*s'", token->length, token->start);
     }
 
-    fprintf(stderr, ": %s\n", message);
+    fprintf(vm.errors, ": %s\n", message);
     parser.hadError = true;
 }
 
@@ -106,7 +140,8 @@ static void advance() {
 
     for (;;) {
         // Consume any TOKEN_ERROR's
-        parser.current = scanToken();
+        parser.current = parser.scanAhead ? nextScannedToken()
+                                          : scanToken();
         if (parser.current.type != TOKEN_ERROR) break;
         
         errorAtCurrent(parser.current.start);
@@ -143,7 +178,41 @@ static void emitBytes(uint8_t byte1, uint8_t byte2) {
     emitByte(byte2);
 }
 
+/* Emit a backwards jump to `loopStart`. If `counted`, this is the
+   loop's back edge and the instruction names a counter for the loop,
+   which the VM bumps every time round. */
+static void emitLoop(int loopStart, bool counted) {
+    emitByte(OP_LOOP);
+
+    // +2 to also jump over OP_LOOP's own offset operand.
+    int offset = currentChunk()->count - loopStart + 2;
+    if (offset > UINT16_MAX) error("Loop body too large.");
+
+    emitByte((offset >> 8) & 0xff);
+    emitByte(offset & 0xff);
+
+    // Once the chunk runs out of loop indices, further loops simply
+    // go uncounted.
+    int loop = LOOP_UNCOUNTED;
+    if (counted && currentChunk()->loopCount < LOOP_UNCOUNTED) {
+        loop = addLoop(currentChunk(), loopStart);
+    }
+    emitByte((loop >> 8) & 0xff);
+    emitByte(loop & 0xff);
+}
+
+/* Emit a forward jump with a placeholder offset, returning where the
+   offset is so patchJump can fill it in once the target is known. */
+static int emitJump(uint8_t instruction) {
+    emitByte(instruction);
+    emitByte(0xff);
+    emitByte(0xff);
+    return currentChunk()->count - 2;
+}
+
+/* Return nil: what falling off the end of a function does. */
 static void emitReturn() {
+    emitByte(OP_NIL);
     emitByte(OP_RETURN);
 }
 
@@ -163,14 +232,56 @@ static void emitConstant(Value value) {
     emitBytes(OP_CONSTANT, makeConstant(value));
 }
 
-static void endCompiler() {
+/* Point the jump whose operand is at `offset` at the next instruction
+   to be emitted. */
+static void patchJump(int offset) {
+    // -2 to adjust for the bytecode for the jump offset itself.
+    int jump = currentChunk()->count - offset - 2;
+
+    if (jump > UINT16_MAX) {
+        error("Too much code to jump over.");
+    }
+
+    currentChunk()->code[offset]     = (jump >> 8) & 0xff;
+    currentChunk()->code[offset + 1] = jump & 0xff;
+}
+
+static void initCompiler(Compiler* compiler, ObjFunction* function,
+                         FunctionType type) {
+    compiler->enclosing  = current;
+    compiler->function   = function;
+    compiler->type       = type;
+    compiler->localCount = 0;
+    compiler->scopeDepth = 0;
+    current = compiler;
+
+    if (type != TYPE_SCRIPT) {
+        function->name = copyString(parser.previous.start,
+                                    parser.previous.length);
+    }
+
+    // Slot 0 holds the function being called. Give it a name no
+    // identifier can have so it can't be referenced.
+    Local* local = &current->locals[current->localCount++];
+    local->depth       = 0;
+    local->name.start  = "";
+    local->name.length = 0;
+}
+
+static ObjFunction* endCompiler() {
     emitReturn();
+    ObjFunction* function = current->function;
 
 #ifdef DEBUG_PRINT_CODE
     if (!parser.hadError) {
-        disassembleChunk(currentChunk(), "code");
+        disassembleChunk(currentChunk(), function->name != NULL
+                                         ? function->name->chars
+                                         : "<script>");
     }
 #endif
+
+    current = current->enclosing;
+    return function;
 }
 
 // Forward declarations for handling declaration cycle.
@@ -185,12 +296,95 @@ static uint8_t identifierConstant(Token* name) {
                                            name->length)));
 }
 
+static bool identifiersEqual(Token* a, Token* b) {
+    if (a->length != b->length) return false;
+    return memcmp(a->start, b->start, a->length) == 0;
+}
+
+/* Find the stack slot of the local called `name`, or -1 if it isn't
+   a local and so must be a global. Walk backwards so that inner
+   declarations shadow outer ones. */
+static int resolveLocal(Compiler* compiler, Token* name) {
+    for (int i = compiler->localCount - 1; i >= 0; i--) {
+        Local* local = &compiler->locals[i];
+        if (identifiersEqual(name, &local->name)) {
+            if (local->depth == -1) {
+                error("Can't read local variable in its own initializer.");
+            }
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+static void addLocal(Token name) {
+    if (current->localCount == UINT8_COUNT) {
+        error("Too many local variables in function.");
+        return;
+    }
+
+    Local* local = &current->locals[current->localCount++];
+    local->name  = name;
+    local->depth = -1;
+}
+
+/* Record a local declared in the current block. Globals are late
+   bound, so there is nothing to do for them here. */
+static void declareVariable() {
+    if (current->scopeDepth == 0) return;
+
+    Token* name = &parser.previous;
+    for (int i = current->localCount - 1; i >= 0; i--) {
+        Local* local = &current->locals[i];
+        if (local->depth != -1 && local->depth < current->scopeDepth) {
+            break;
+        }
+
+        if (identifiersEqual(name, &local->name)) {
+            error("Already a variable with this name in this scope.");
+        }
+    }
+
+    addLocal(*name);
+}
+
 static uint8_t parseVariable(const char* errorMessage) {
     consume(TOKEN_IDENTIFIER, errorMessage);
+
+    declareVariable();
+    // Locals are looked up by slot, so they need no name constant.
+    if (current->scopeDepth > 0) return 0;
+
     return identifierConstant(&parser.previous);
 }
 
-static void binary() {
+static void beginScope() {
+    current->scopeDepth++;
+}
+
+/* Leave a block, discarding its locals from the stack with a single
+   instruction. */
+static void endScope() {
+    current->scopeDepth--;
+
+    int popped = 0;
+    while (current->localCount > 0 &&
+           current->locals[current->localCount - 1].depth >
+               current->scopeDepth) {
+        current->localCount--;
+        popped++;
+    }
+
+    if (popped == 1) {
+        emitByte(OP_POP);
+    } else if (popped > 1) {
+        emitBytes(OP_POPN, (uint8_t)popped);
+    }
+}
+
+static void binary(bool canAssign) {
+    (void)canAssign;
     // Binary operators are left-assosciative for the same operator:
     //    1 + 2 + 3
     // should be parsed as
@@ -227,7 +421,80 @@ static void binary() {
     }
 }
 
-static void literal() {
+/* `and` short-circuits: if the left operand is falsey it is the result,
+   and the right operand is skipped. */
+static void and_(bool canAssign) {
+    (void)canAssign;
+    int endJump = emitJump(OP_JUMP_IF_FALSE);
+
+    emitByte(OP_POP);
+    parsePrecedence(PREC_AND);
+
+    patchJump(endJump);
+}
+
+/* `or` short-circuits: if the left operand is truthy it is the result. */
+static void or_(bool canAssign) {
+    (void)canAssign;
+    int elseJump = emitJump(OP_JUMP_IF_FALSE);
+    int endJump  = emitJump(OP_JUMP);
+
+    patchJump(elseJump);
+    emitByte(OP_POP);
+
+    parsePrecedence(PREC_OR);
+    patchJump(endJump);
+}
+
+static uint8_t argumentList() {
+    uint8_t argCount = 0;
+    if (!check(TOKEN_RIGHT_PAREN)) {
+        do {
+            expression();
+            if (argCount == 255) {
+                error("Can't have more than 255 arguments.");
+            }
+            argCount++;
+        } while (match(TOKEN_COMMA));
+    }
+
+    consume(TOKEN_RIGHT_PAREN, "Expect ')' after arguments.");
+    return argCount;
+}
+
+/* The callee is already on the stack; push the arguments after it so
+   they become the start of the callee's stack window. */
+static void call(bool canAssign) {
+    (void)canAssign;
+    uint8_t argCount = argumentList();
+    emitBytes(OP_CALL, argCount);
+}
+
+/* Emit a property instruction's operands: the name, then a fresh
+   inline cache for this access site. */
+static void emitProperty(uint8_t instruction, uint8_t name) {
+    emitBytes(instruction, name);
+
+    int cache = addPropertyCache(currentChunk());
+    if (cache > UINT16_MAX) error("Too many property accesses in one chunk.");
+    emitByte((cache >> 8) & 0xff);
+    emitByte(cache & 0xff);
+}
+
+static void dot(bool canAssign) {
+    consume(TOKEN_IDENTIFIER, "Expect property name after '.'.");
+    uint8_t name = identifierConstant(&parser.previous);
+
+    if (canAssign && match(TOKEN_EQUAL)) {
+        expression();
+        emitProperty(OP_SET_PROPERTY, name);
+    } else {
+        emitProperty(OP_GET_PROPERTY, name);
+    }
+}
+
+static void literal(bool canAssign) {
+    (void)canAssign;
     switch (parser.previous.type) {
         case TOKEN_FALSE: emitByte(OP_FALSE); break;
         case TOKEN_NIL:   emitByte(OP_NIL);   break;
@@ -236,7 +503,8 @@ static void literal() {
     }
 }
 /* Handle parenthetic expressions such as ((1 + 2) * 3) */
-static void grouping() {
+static void grouping(bool canAssign) {
+    (void)canAssign;
 
     // Recursively called
     expression();
@@ -245,35 +513,57 @@ static void grouping() {
 }
 
 /* Write a parsed number literal as a const */
-static void number() {
+static void number(bool canAssign) {
+    (void)canAssign;
     // Assume that the number literal has been consumed
     // and stored in `parser.previous`.
-    double value = strtod(parser.previous.start, NULL);
+    double value = parseNumber(parser.previous.start,
+                               parser.previous.length);
     emitConstant(NUMBER_VAL(value));
 }
 
-static void string() {
+static void string(bool canAssign) {
+    (void)canAssign;
     // +1 because string starts after the first quotation mark.
     // -2 because the length of the string doesn't count the quotes. 
     emitConstant(OBJ_VAL(copyString(parser.previous.start  + 1,
                                     parser.previous.length - 2)));
 }
 
-static void namedVariable(Token name) {
-    uint8_t arg = identifierConstant(&name);
-    emitBytes(OP_GET_GLOBAL, arg);
+/* Emit a read of the variable `name`, or an assignment to it if it
+   is followed by `=` somewhere assignment is allowed. Locals are
+   addressed by stack slot; only globals go through the table. */
+static void namedVariable(Token name, bool canAssign) {
+    uint8_t getOp, setOp;
+    int arg = resolveLocal(current, &name);
+    if (arg != -1) {
+        getOp = OP_GET_LOCAL;
+        setOp = OP_SET_LOCAL;
+    } else {
+        arg   = identifierConstant(&name);
+        getOp = OP_GET_GLOBAL;
+        setOp = OP_SET_GLOBAL;
+    }
+
+    if (canAssign && match(TOKEN_EQUAL)) {
+        expression();
+        emitBytes(setOp, (uint8_t)arg);
+    } else {
+        emitBytes(getOp, (uint8_t)arg);
+    }
 }
 
-static void variable() {
-    namedVariable(parser.previous);
+static void variable(bool canAssign) {
+    namedVariable(parser.previous, canAssign);
 }
 
 /* Dispatch a unary operator to the appropriate byte emitter */ 
-static void unary() {
+static void unary(bool canAssign) {
+    (void)canAssign;
     TokenType operatorType = parser.previous.type;
 
-    // Recursively called
-    expression(PREC_UNARY);
+    // Compile the operand.
+    parsePrecedence(PREC_UNARY);
 
     // Emit the operator's instruction
     switch (operatorType) {
@@ -290,12 +580,12 @@ static void unary() {
    applicable, as well as the precedence of that operator token.
 */
 ParseRule rules[] = {
-    [TOKEN_LEFT_PAREN]    = {grouping,  NULL,   PREC_NONE},
+    [TOKEN_LEFT_PAREN]    = {grouping,  call,   PREC_CALL},
     [TOKEN_RIGHT_PAREN]   = {NULL,      NULL,   PREC_NONE},
     [TOKEN_LEFT_BRACE]    = {NULL,      NULL,   PREC_NONE},
     [TOKEN_RIGHT_BRACE]   = {NULL,      NULL,   PREC_NONE},
     [TOKEN_COMMA]         = {NULL,      NULL,   PREC_NONE},
-    [TOKEN_DOT]           = {NULL,      NULL,   PREC_NONE},
+    [TOKEN_DOT]           = {NULL,      dot,    PREC_CALL},
     [TOKEN_MINUS]         = {unary,     binary, PREC_TERM},
     [TOKEN_PLUS]          = {NULL,      binary, PREC_TERM},
     [TOKEN_SEMICOLON]     = {NULL,      NULL,   PREC_NONE},
@@ -312,7 +602,7 @@ ParseRule rules[] = {
     [TOKEN_IDENTIFIER]    = {variable,  NULL,   PREC_NONE},
     [TOKEN_STRING]        = {string,    NULL,   PREC_NONE},
     [TOKEN_NUMBER]        = {number,    NULL,   PREC_NONE},
-    [TOKEN_AND]           = {NULL,      NULL,   PREC_NONE},
+    [TOKEN_AND]           = {NULL,      and_,   PREC_AND},
     [TOKEN_CLASS]         = {NULL,      NULL,   PREC_NONE},
     [TOKEN_ELSE]          = {NULL,      NULL,   PREC_NONE},
     [TOKEN_FALSE]         = {literal,   NULL,   PREC_NONE},
@@ -320,7 +610,7 @@ ParseRule rules[] = {
     [TOKEN_FUN]           = {NULL,      NULL,   PREC_NONE},
     [TOKEN_IF]            = {NULL,      NULL,   PREC_NONE},
     [TOKEN_NIL]           = {literal,   NULL,   PREC_NONE},
-    [TOKEN_OR]            = {NULL,      NULL,   PREC_NONE},
+    [TOKEN_OR]            = {NULL,      or_,    PREC_OR},
     [TOKEN_PRINT]         = {NULL,      NULL,   PREC_NONE},
     [TOKEN_RETURN]        = {NULL,      NULL,   PREC_NONE},
     [TOKEN_SUPER]         = {NULL,      NULL,   PREC_NONE},
@@ -341,19 +631,39 @@ static void parsePrecedence(Precedence precedence) {
         return;
     }
 
-    prefixRule();
+    // Only a low-precedence context may treat `=` as assignment;
+    // otherwise `a * b = c` would assign to `b`.
+    bool canAssign = precedence <= PREC_ASSIGNMENT;
+    prefixRule(canAssign);
 
     // Recurisvely handle operators with higher precedent.
     while (precedence <= getRule(parser.current.type)->precedence) {
         advance();
         ParseFn infixRule = getRule(parser.previous.type)->infix;
-        infixRule();
+        infixRule(canAssign);
+    }
+
+    if (canAssign && match(TOKEN_EQUAL)) {
+        error("Invalid assignment target.");
     }
 }
 
-/* Outputs a bytecode instruction which defines a new variable and
- * stores the value of this variable globally */
+/* Mark the most recently declared local as usable. */
+static void markInitialized() {
+    // A function declared at the top level is a global.
+    if (current->scopeDepth == 0) return;
+    current->locals[current->localCount - 1].depth = current->scopeDepth;
+}
+
+/* Outputs a bytecode instruction which defines a new global variable.
+ * A local needs no instruction: its initial value is already sitting
+ * in its stack slot. */
 static void defineVariable(uint8_t global) {
+    if (current->scopeDepth > 0) {
+        markInitialized();
+        return;
+    }
+
     emitBytes(OP_DEFINE_GLOBAL, global);
 }
 
@@ -365,6 +675,55 @@ static void expression() {
     parsePrecedence(PREC_ASSIGNMENT);
 }
 
+static void block();
+
+/* Compile a function's parameters and body into a new function object,
+   and emit it as a constant. */
+static void function(FunctionType type) {
+    Compiler compiler;
+    initCompiler(&compiler, newFunction(), type);
+    beginScope();
+
+    consume(TOKEN_LEFT_PAREN, "Expect '(' after function name.");
+    if (!check(TOKEN_RIGHT_PAREN)) {
+        do {
+            current->function->arity++;
+            if (current->function->arity > 255) {
+                errorAtCurrent("Can't have more than 255 parameters.");
+            }
+            uint8_t constant = parseVariable("Expect parameter name.");
+            defineVariable(constant);
+        } while (match(TOKEN_COMMA));
+    }
+    consume(TOKEN_RIGHT_PAREN, "Expect ')' after parameters.");
+    consume(TOKEN_LEFT_BRACE, "Expect '{' before function body.");
+    block();
+
+    // No endScope(): the whole window goes when the function returns.
+    ObjFunction* function = endCompiler();
+    emitConstant(OBJ_VAL(function));
+}
+
+static void classDeclaration() {
+    consume(TOKEN_IDENTIFIER, "Expect class name.");
+    uint8_t nameConstant = identifierConstant(&parser.previous);
+    declareVariable();
+
+    emitBytes(OP_CLASS, nameConstant);
+    defineVariable(nameConstant);
+
+    consume(TOKEN_LEFT_BRACE, "Expect '{' before class body.");
+    consume(TOKEN_RIGHT_BRACE, "Expect '}' after class body.");
+}
+
+static void funDeclaration() {
+    uint8_t global = parseVariable("Expect function name.");
+    // A function may refer to itself, so it's usable straight away.
+    markInitialized();
+    function(TYPE_FUNCTION);
+    defineVariable(global);
+}
+
 static void varDeclaration() {
     uint8_t global = parseVariable("Expect variable name.");
 
@@ -378,6 +737,14 @@ static void varDeclaration() {
     defineVariable(global);
 }
 
+static void block() {
+    while (!check(TOKEN_RIGHT_BRACE) && !check(TOKEN_EOF)) {
+        declaration();
+    }
+
+    consume(TOKEN_RIGHT_BRACE, "Expect '}' after block.");
+}
+
 /* Consume an expression statement into an instruction byte */
 static void expressionStatement() {
     expression();
@@ -385,6 +752,80 @@ static void expressionStatement() {
     emitByte(OP_POP);
 }
 
+/* for (initializer; condition; increment) body
+
+   The increment is compiled before the body but has to run after it,
+   so the body jumps back to the increment, which then loops back to
+   the condition. */
+static void forStatement() {
+    // A variable declared in the initializer is scoped to the loop.
+    beginScope();
+    consume(TOKEN_LEFT_PAREN, "Expect '(' after 'for'.");
+    if (match(TOKEN_SEMICOLON)) {
+        // No initializer.
+    } else if (match(TOKEN_VAR)) {
+        varDeclaration();
+    } else {
+        expressionStatement();
+    }
+
+    int  loopStart = currentChunk()->count;
+    int  exitJump  = -1;
+    bool counted   = true;
+    if (!match(TOKEN_SEMICOLON)) {
+        expression();
+        consume(TOKEN_SEMICOLON, "Expect ';' after loop condition.");
+
+        // Jump out of the loop if the condition is false.
+        exitJump = emitJump(OP_JUMP_IF_FALSE);
+        emitByte(OP_POP); // Condition.
+    }
+
+    if (!match(TOKEN_RIGHT_PAREN)) {
+        int bodyJump       = emitJump(OP_JUMP);
+        int incrementStart = currentChunk()->count;
+        expression();
+        emitByte(OP_POP);
+        consume(TOKEN_RIGHT_PAREN, "Expect ')' after for clauses.");
+
+        // The increment's jump back to the condition is the back edge;
+        // the body only jumps back to get to the increment.
+        emitLoop(loopStart, true);
+        loopStart = incrementStart;
+        counted   = false;
+        patchJump(bodyJump);
+    }
+
+    statement();
+    emitLoop(loopStart, counted);
+
+    if (exitJump != -1) {
+        patchJump(exitJump);
+        emitByte(OP_POP); // Condition.
+    }
+
+    endScope();
+}
+
+static void ifStatement() {
+    consume(TOKEN_LEFT_PAREN, "Expect '(' after 'if'.");
+    expression();
+    consume(TOKEN_RIGHT_PAREN, "Expect ')' after condition.");
+
+    // The condition stays on the stack, so each branch pops it first.
+    int thenJump = emitJump(OP_JUMP_IF_FALSE);
+    emitByte(OP_POP);
+    statement();
+
+    int elseJump = emitJump(OP_JUMP);
+
+    patchJump(thenJump);
+    emitByte(OP_POP);
+
+    if (match(TOKEN_ELSE)) statement();
+    patchJump(elseJump);
+}
+
 /* Consume a print statement into a print instruction byte */
 static void printStatement() {
     expression();
@@ -393,6 +834,35 @@ static void printStatement() {
 }
 
 
+static void returnStatement() {
+    if (current->type == TYPE_SCRIPT) {
+        error("Can't return from top-level code.");
+    }
+
+    if (match(TOKEN_SEMICOLON)) {
+        emitReturn();
+    } else {
+        expression();
+        consume(TOKEN_SEMICOLON, "Expect ';' after return value.");
+        emitByte(OP_RETURN);
+    }
+}
+
+static void whileStatement() {
+    int loopStart = currentChunk()->count;
+    consume(TOKEN_LEFT_PAREN, "Expect '(' after 'while'.");
+    expression();
+    consume(TOKEN_RIGHT_PAREN, "Expect ')' after condition.");
+
+    int exitJump = emitJump(OP_JUMP_IF_FALSE);
+    emitByte(OP_POP);
+    statement();
+    emitLoop(loopStart, true);
+
+    patchJump(exitJump);
+    emitByte(OP_POP);
+}
+
 /* Skip tokens until we find a statement boundary.
  *
  * A statement boundary either has a preceding semicolon e.g:
@@ -431,7 +901,11 @@ static void synchronize(){
 }
 
 static void declaration() {
-    if (match(TOKEN_VAR)) {
+    if (match(TOKEN_CLASS)) {
+        classDeclaration();
+    } else if (match(TOKEN_FUN)) {
+        funDeclaration();
+    } else if (match(TOKEN_VAR)) {
         varDeclaration();
     } else {
         statement();
@@ -443,28 +917,115 @@ static void declaration() {
 static void statement() {
     if (match(TOKEN_PRINT)) { 
         printStatement();
+    } else if (match(TOKEN_FOR)) {
+        forStatement();
+    } else if (match(TOKEN_IF)) {
+        ifStatement();
+    } else if (match(TOKEN_RETURN)) {
+        returnStatement();
+    } else if (match(TOKEN_WHILE)) {
+        whileStatement();
+    } else if (match(TOKEN_LEFT_BRACE)) {
+        beginScope();
+        block();
+        endScope();
     } else {
         expressionStatement();
     }
 }
 
 
-/* Compile the scanned source to bytecode.
-   Return true on success and false if an error occurred
-   during parsing */
-bool compile(const char* source, Chunk* chunk) {
-    initScanner(source);
-    compilingChunk = chunk;
+static void startCompile(const char* source, bool scanAhead) {
+    parser.scanAhead = scanAhead;
+    if (scanAhead) {
+        startScanAhead(source);
+    } else {
+        initScanner(source);
+    }
 
     parser.hadError  = false;
     parser.panicMode = false;
 
     advance();
+}
+
+/* Compile the scanned source to bytecode for a top-level script
+   function. Return NULL if an error occurred during parsing. */
+ObjFunction* compile(const char* source) {
+    double start = traceEnabled ? traceNow() : 0;
+    startCompile(source, vm.pipelineScanner);
+
+    Compiler compiler;
+    initCompiler(&compiler, newFunction(), TYPE_SCRIPT);
 
     while (!match(TOKEN_EOF)) {
         declaration();
     }
 
+    ObjFunction* function = endCompiler();
+    if (parser.scanAhead) finishScanAhead();
+    if (traceEnabled) {
+        traceSpan("compile", start, NULL);
+        traceCounters();
+    }
+    return parser.hadError ? NULL : function;
+}
+
+/* Start compiling `source` one top-level declaration at a time. */
+void beginCompileStream(const char* source) {
+    startCompile(source, false);
+}
+
+/* Compile the next top-level declaration of the stream into the
+   empty `script` function, ending it with a return so it can be
+   run on its own.
+
+   Errors are reported as usual. Once one has been seen every later
+   declaration is still compiled, to report its errors too, but
+   reported as COMPILE_STEP_ERROR. */
+CompileStep compileNext(ObjFunction* script) {
+    if (match(TOKEN_EOF)) return COMPILE_STEP_END;
+
+    double start = traceEnabled ? traceNow() : 0;
+    Compiler compiler;
+    initCompiler(&compiler, script, TYPE_SCRIPT);
+    declaration();
     endCompiler();
-    return !parser.hadError;
+    if (traceEnabled) traceSpan("compile", start, NULL);
+
+    return parser.hadError ? COMPILE_STEP_ERROR : COMPILE_STEP_OK;
+}
+
+/* Compile `source`, a single expression, into a function that returns
+   its value. `inputs` become the function's parameters, in order, so
+   the expression reads them from its stack window like any local
+   instead of looking them up as globals. Return NULL on error. */
+ObjFunction* compileExpression(const char* source, const char** inputs,
+                               int inputCount) {
+    double start = traceEnabled ? traceNow() : 0;
+    startCompile(source, false);
+
+    Compiler compiler;
+    initCompiler(&compiler, newFunction(), TYPE_SCRIPT);
+    if (inputCount > 255) {
+        errorAtCurrent("Can't have more than 255 inputs.");
+        inputCount = 255;
+    }
+    for (int i = 0; i < inputCount; i++) {
+        Local* local = &current->locals[current->localCount++];
+        local->name.type   = TOKEN_IDENTIFIER;
+        local->name.start  = inputs[i];
+        local->name.length = (int)strlen(inputs[i]);
+        local->name.line   = 0;
+        local->depth       = 0;
+    }
+    current->function->arity = inputCount;
+
+    expression();
+    consume(TOKEN_EOF, "Expect end of expression.");
+    emitByte(OP_RETURN);
+
+    ObjFunction* function = endCompiler();
+    if (traceEnabled) traceSpan("compile", start, NULL);
+    return parser.hadError ? NULL : function;
 }
@@ -4,6 +4,16 @@
 #include "object.h"
 #include "vm.h"
 
-bool compile(const char* source, Chunk* chunk);
+typedef enum {
+    COMPILE_STEP_OK,
+    COMPILE_STEP_ERROR,
+    COMPILE_STEP_END,
+} CompileStep;
+
+ObjFunction* compile(const char* source);
+void beginCompileStream(const char* source);
+CompileStep compileNext(ObjFunction* script);
+ObjFunction* compileExpression(const char* source, const char** inputs,
+                               int inputCount);
 
 #endif
\ No newline at end of file
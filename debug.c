@@ -1,6 +1,8 @@
 #include <stdio.h>
+#include <stdlib.h>
 
 #include "debug.h"
+#include "object.h"
 #include "value.h"
 
 void disassembleChunk(Chunk* chunk, const char* name) {
@@ -28,6 +30,76 @@ static int constantInstruction(const char* name, Chunk* chunk,
     return offset + 2;
 }
 
+/* An instruction with a one-byte operand that isn't a constant index,
+ * such as a stack slot or a count. */
+static int byteInstruction(const char* name, Chunk* chunk, int offset) {
+    uint8_t operand = chunk->code[offset + 1];
+    printf("%-16s %4d\n", name, operand);
+    return offset + 2;
+}
+
+/* A jump, shown with the offset it lands on. `sign` is -1 for
+ * backwards jumps. */
+static int jumpInstruction(const char* name, int sign, Chunk* chunk,
+                           int offset) {
+    uint16_t jump = (uint16_t)(chunk->code[offset + 1] << 8);
+    jump |= chunk->code[offset + 2];
+    printf("%-16s %4d -> %d\n", name, offset,
+           offset + 3 + sign * jump);
+    return offset + 3;
+}
+
+/* A loop's back edge, with how often it has been taken so far. */
+static int loopInstruction(const char* name, Chunk* chunk, int offset) {
+    uint16_t jump = (uint16_t)(chunk->code[offset + 1] << 8);
+    jump |= chunk->code[offset + 2];
+    uint16_t loop = (uint16_t)(chunk->code[offset + 3] << 8);
+    loop |= chunk->code[offset + 4];
+    printf("%-16s %4d -> %d", name, offset, offset + 3 - jump);
+    if (loop != LOOP_UNCOUNTED) {
+        printf(" count: %llu",
+               (unsigned long long)chunk->loops[loop].count);
+    }
+    printf("\n");
+    return offset + 5;
+}
+
+/* A property access, with what its inline cache holds. */
+static int propertyInstruction(const char* name, Chunk* chunk,
+                               int offset) {
+    uint8_t constant = chunk->code[offset + 1];
+    int     index    = (chunk->code[offset + 2] << 8) | chunk->code[offset + 3];
+    PropertyCache* cache = &chunk->caches[index];
+
+    printf("%-16s %4d '", name, constant);
+    printValue(chunk->constants.values[constant]);
+    printf("' cache %d", index);
+    if (cache->shape != NULL) {
+        printf(": slot %d%s", cache->slot,
+               cache->transition != NULL ? " (adds field)" : "");
+    }
+    printf("\n");
+    return offset + 4;
+}
+
+/* An arithmetic instruction, followed by any type feedback it has
+ * gathered so far. */
+static int arithmeticInstruction(const char* name, Chunk* chunk,
+                                 int offset) {
+    uint8_t feedback = chunk->feedback[offset];
+    if (feedback == 0) return simpleInstruction(name, offset);
+
+    printf("%-16s seen:", name);
+    if (feedback & FEEDBACK_NUMBERS) printf(" num");
+    if (feedback & FEEDBACK_STRINGS) printf(" str");
+    if (feedback & FEEDBACK_OTHER)   printf(" other");
+    if (FEEDBACK_DEOPTS(feedback) > 0) {
+        printf(" deopts: %d", FEEDBACK_DEOPTS(feedback));
+    }
+    printf("\n");
+    return offset + 1;
+}
+
 int disassembleInstruction(Chunk* chunk, int offset) {
     printf("%04d ", offset);
     if (offset > 0 && chunk->lines[offset] == chunk->lines[offset - 1]) {
@@ -51,36 +123,172 @@ int disassembleInstruction(Chunk* chunk, int offset) {
             return simpleInstruction("OP_FALSE", offset);
         case OP_POP:
             return simpleInstruction("OP_POP", offset);
+        case OP_POPN:
+            return byteInstruction("OP_POPN", chunk, offset);
+        case OP_GET_LOCAL:
+            return byteInstruction("OP_GET_LOCAL", chunk, offset);
+        case OP_SET_LOCAL:
+            return byteInstruction("OP_SET_LOCAL", chunk, offset);
         case OP_GET_GLOBAL:
             return constantInstruction("OP_GET_GLOBAL", chunk,
                                         offset);
         case OP_DEFINE_GLOBAL:
             return constantInstruction("OP_DEFINE_GLOBAL", chunk, 
                                         offset);
+        case OP_SET_GLOBAL:
+            return constantInstruction("OP_SET_GLOBAL", chunk, offset);
+        case OP_GET_PROPERTY:
+            return propertyInstruction("OP_GET_PROPERTY", chunk, offset);
+        case OP_SET_PROPERTY:
+            return propertyInstruction("OP_SET_PROPERTY", chunk, offset);
         case OP_EQUAL:
             return simpleInstruction("OP_EQUAL", offset);
         case OP_GREATER:
-            return simpleInstruction("OP_GREATER", offset);
+            return arithmeticInstruction("OP_GREATER", chunk, offset);
         case OP_LESS:
-            return simpleInstruction("OP_LESS", offset);
+            return arithmeticInstruction("OP_LESS", chunk, offset);
         case OP_ADD:
-            return simpleInstruction("OP_ADD", offset);
+            return arithmeticInstruction("OP_ADD", chunk, offset);
         case OP_SUBTRACT:
-            return simpleInstruction("OP_SUBTRACT", offset);
+            return arithmeticInstruction("OP_SUBTRACT", chunk, offset);
         case OP_MULTIPLY:
-            return simpleInstruction("OP_MULTIPLY", offset);
+            return arithmeticInstruction("OP_MULTIPLY", chunk, offset);
         case OP_DIVIDE:
-            return simpleInstruction("OP_DIVIDE", offset);
+            return arithmeticInstruction("OP_DIVIDE", chunk, offset);
         case OP_NOT:
             return simpleInstruction("OP_NOT", offset);
         case OP_NEGATE:
             return simpleInstruction("OP_NEGATE", offset);
         case OP_PRINT:
             return simpleInstruction("OP_PRINT", offset);
+        case OP_JUMP:
+            return jumpInstruction("OP_JUMP", 1, chunk, offset);
+        case OP_JUMP_IF_FALSE:
+            return jumpInstruction("OP_JUMP_IF_FALSE", 1, chunk, offset);
+        case OP_LOOP:
+            return loopInstruction("OP_LOOP", chunk, offset);
+        case OP_CALL:
+            return byteInstruction("OP_CALL", chunk, offset);
+        case OP_CLASS:
+            return constantInstruction("OP_CLASS", chunk, offset);
         case OP_RETURN:
             return simpleInstruction("OP_RETURN", offset);
+        case OP_GREATER_NUM:
+            return arithmeticInstruction("OP_GREATER_NUM", chunk, offset);
+        case OP_LESS_NUM:
+            return arithmeticInstruction("OP_LESS_NUM", chunk, offset);
+        case OP_ADD_NUM:
+            return arithmeticInstruction("OP_ADD_NUM", chunk, offset);
+        case OP_SUBTRACT_NUM:
+            return arithmeticInstruction("OP_SUBTRACT_NUM", chunk, offset);
+        case OP_MULTIPLY_NUM:
+            return arithmeticInstruction("OP_MULTIPLY_NUM", chunk, offset);
+        case OP_DIVIDE_NUM:
+            return arithmeticInstruction("OP_DIVIDE_NUM", chunk, offset);
         default:
             printf("Unkown opcode %d\n", instruction);
             return offset + 1;
     }
-}
\ No newline at end of file
+}
+
+typedef struct {
+    ObjFunction* function;
+    LoopCounter* loop;
+} HotLoop;
+
+static int compareLoopCounts(const void* a, const void* b) {
+    uint64_t countA = ((const HotLoop*)a)->loop->count;
+    uint64_t countB = ((const HotLoop*)b)->loop->count;
+    return (countA < countB) - (countA > countB);
+}
+
+/* Print the loops of every function on the `objects` list to stderr,
+   hottest first. */
+void printHotLoops(Obj* objects) {
+    int total = 0;
+    for (Obj* object = objects; object != NULL; object = object->next) {
+        if (object->type != OBJ_FUNCTION) continue;
+        total += ((ObjFunction*)object)->chunk.loopCount;
+    }
+    if (total == 0) return;
+
+    HotLoop* loops = malloc(sizeof(HotLoop) * total);
+    if (loops == NULL) return;
+
+    int count = 0;
+    for (Obj* object = objects; object != NULL; object = object->next) {
+        if (object->type != OBJ_FUNCTION) continue;
+        ObjFunction* function = (ObjFunction*)object;
+        for (int i = 0; i < function->chunk.loopCount; i++) {
+            loops[count].function = function;
+            loops[count].loop     = &function->chunk.loops[i];
+            count++;
+        }
+    }
+    qsort(loops, count, sizeof(HotLoop), compareLoopCounts);
+
+    fprintf(stderr, "== hot loops ==\n");
+    fprintf(stderr, "%20s %6s %6s  %s\n",
+            "iterations", "line", "header", "function");
+    for (int i = 0; i < count; i++) {
+        ObjFunction* function = loops[i].function;
+        LoopCounter* loop     = loops[i].loop;
+        fprintf(stderr, "%20llu %6d   %04d  %s%s\n",
+                (unsigned long long)loop->count,
+                function->chunk.lines[loop->header], loop->header,
+                function->name == NULL ? "<script>"
+                                       : function->name->chars,
+                loop->count >= LOOP_HOT_THRESHOLD ? "  hot" : "");
+    }
+
+    free(loops);
+}
+
+/* Print each table's size, load and probe counters to stderr, then
+   its probe-length histogram as a percentage of lookups. */
+void printTableStats(TableReport* reports, int count) {
+    fprintf(stderr, "== table stats ==\n");
+    fprintf(stderr, "%-10s %9s %9s %6s %10s %7s %10s %9s %9s\n",
+            "table", "entries", "capacity", "load", "tombstones",
+            "resizes", "lookups", "avg probe", "max probe");
+    for (int i = 0; i < count; i++) {
+        TableReport* report = &reports[i];
+        TableStats*  stats  = &report->stats;
+        double load = report->capacity == 0
+            ? 0 : (double)(report->entries + report->tombstones) /
+                  report->capacity;
+        double average = stats->lookups == 0
+            ? 0 : (double)stats->probes / stats->lookups;
+        fprintf(stderr, "%-10s %9d %9d %6.2f %10d %7d %10llu %9.2f %9d\n",
+                report->name, report->entries, report->capacity, load,
+                report->tombstones, stats->resizes,
+                (unsigned long long)stats->lookups, average,
+                stats->maxProbes);
+    }
+
+    fprintf(stderr, "== probe lengths (%% of lookups) ==\n");
+    fprintf(stderr, "%-7s", "probes");
+    for (int i = 0; i < count; i++) {
+        fprintf(stderr, " %10s", reports[i].name);
+    }
+    fprintf(stderr, "\n");
+    for (int bucket = 1; bucket < TABLE_STATS_BUCKETS; bucket++) {
+        bool any = false;
+        for (int i = 0; i < count; i++) {
+            if (reports[i].stats.histogram[bucket] > 0) any = true;
+        }
+        if (!any) continue;
+
+        char label[16];
+        snprintf(label, sizeof(label), "%d%s", bucket,
+                 bucket == TABLE_STATS_BUCKETS - 1 ? "+" : "");
+        fprintf(stderr, "%-7s", label);
+        for (int i = 0; i < count; i++) {
+            TableStats* stats = &reports[i].stats;
+            double percent = stats->lookups == 0
+                ? 0 : 100.0 * stats->histogram[bucket] / stats->lookups;
+            fprintf(stderr, " %9.2f%%", percent);
+        }
+        fprintf(stderr, "\n");
+    }
+}
@@ -2,8 +2,21 @@
 #define clox_debug_h
 
 #include "chunk.h"
+#include "object.h"
+#include "table.h"
+
+/* One hashtable's line of the --table-stats report. */
+typedef struct {
+    const char* name;
+    TableStats  stats;
+    int         entries;    // Live keys.
+    int         capacity;
+    int         tombstones;
+} TableReport;
 
 void disassembleChunk(Chunk* chunk, const char* name);
 int disassembleInstruction(Chunk* chunk, int offset);
+void printHotLoops(Obj* objects);
+void printTableStats(TableReport* reports, int count);
 
 #endif
@@ -0,0 +1,43 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "compiler.h"
+#include "embed.h"
+#include "memory.h"
+
+/* Compile `source` with `names` as its inputs, all bound to nil to
+ * begin with. Compile errors go to vm.errors as usual, and return
+ * NULL. */
+Expression* newExpression(const char* source, const char** names,
+                          int count) {
+    ObjFunction* function = compileExpression(source, names, count);
+    if (function == NULL) return NULL;
+
+    Expression* expression = ALLOCATE(Expression, 1);
+    expression->function   = function;
+    expression->inputCount = count;
+    expression->names      = ALLOCATE(ObjString*, count);
+    expression->inputs     = ALLOCATE(Value, count);
+    for (int i = 0; i < count; i++) {
+        expression->names[i]  = copyString(names[i], (int)strlen(names[i]));
+        expression->inputs[i] = NIL_VAL;
+    }
+    return expression;
+}
+
+void freeExpression(Expression* expression) {
+    FREE_ARRAY(ObjString*, expression->names, expression->inputCount);
+    FREE_ARRAY(Value, expression->inputs, expression->inputCount);
+    FREE(Expression, expression);
+}
+
+/* The index of the input called `name`, for bindInput(), or -1 if
+ * there's no such input. When a name is given twice the expression
+ * sees the last one. */
+int expressionInput(Expression* expression, const char* name) {
+    ObjString* string = copyString(name, (int)strlen(name));
+    for (int i = expression->inputCount - 1; i >= 0; i--) {
+        if (expression->names[i] == string) return i;
+    }
+    return -1;
+}
@@ -0,0 +1,55 @@
+#ifndef clox_embed_h
+#define clox_embed_h
+
+#include "common.h"
+#include "object.h"
+#include "value.h"
+#include "vm.h"
+
+/* Evaluating one expression many times over from C.
+ *
+ * newExpression() compiles the source once into a function whose
+ * parameters are the named inputs, so inside the expression an input
+ * is a stack slot, not a global to look up by name. Find an input's
+ * index once with expressionInput(), set it with bindInput() before
+ * each evaluation, and evaluate() just calls the function: there is
+ * no scanning, compiling or allocation, unless the expression itself
+ * builds a string or an instance.
+ *
+ *     const char*  names[] = {"price", "qty"};
+ *     Expression*  rule    = newExpression("price * qty > 100",
+ *                                          names, 2);
+ *     int          price   = expressionInput(rule, "price");
+ *     ...
+ *     bindInput(rule, price, NUMBER_VAL(12.5));
+ *     if (evaluate(rule, &result) == INTERPRET_OK) ...
+ *
+ * Other names in the expression are globals of the VM it runs on. An
+ * expression must be evaluated on the thread that compiled it, with
+ * initVM() done and nothing else running on that VM (so not from
+ * inside a native). Its function, like any compiled code, lives until
+ * the VM is freed or reset. */
+typedef struct {
+    ObjFunction* function;
+    int          inputCount;
+    ObjString**  names;  // The inputs', in order.
+    Value*       inputs; // Their values for the next evaluation.
+} Expression;
+
+Expression* newExpression(const char* source, const char** names,
+                          int count);
+void        freeExpression(Expression* expression);
+int         expressionInput(Expression* expression, const char* name);
+
+static inline void bindInput(Expression* expression, int input,
+                             Value value) {
+    expression->inputs[input] = value;
+}
+
+static inline InterpretResult evaluate(Expression* expression,
+                                       Value* result) {
+    return callFunction(expression->function, expression->inputs,
+                        result);
+}
+
+#endif
@@ -0,0 +1,621 @@
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "intern.h"
+#include "memory.h"
+#include "table.h"
+#include "trace.h"
+
+#define INTERN_MAX_LOAD         0.75
+#define INTERN_INITIAL_CAPACITY 64
+
+// Stripes grow incrementally, like an incremental Table: each insert
+// moves INTERN_MIGRATE_SLOTS slots of the old array into the new one,
+// so a stripe of capacity C has moved everything within C / 16
+// inserts, when the doubled array is at most 0.82C of 2C full.
+#define INTERN_MIGRATE_SLOTS 16
+
+// Once a stripe is this full each insert clears INTERN_PREPARE_SLOTS
+// slots of the array it will grow into, so growing doesn't have to
+// clear (and fault in) the whole of it at once.
+#define INTERN_PREPARE_LOAD  0.625
+#define INTERN_PREPARE_SLOTS 4096
+
+// Removed strings and arrays wait on their stripe until there are this
+// many, then are freed together after a single wait for readers.
+#define INTERN_FREE_BATCH 64
+
+// Stripes are picked with the low bits of the hash, so slots within a
+// stripe are picked with the bits above those.
+#define STRIPE_BITS 6
+#define STRIPE_OF(hash) ((hash) & (INTERN_STRIPES - 1))
+#define SLOT_HASH(hash) ((hash) >> STRIPE_BITS)
+
+#ifdef PROBE_STATS
+_Thread_local uint64_t internProbes = 0;
+#define COUNT_PROBE() (internProbes++)
+#else
+#define COUNT_PROBE() ((void)0)
+#endif
+
+// Health counters for lookups on this thread, once internTrackStats
+// has been called.
+static bool                    trackStats = false;
+static _Thread_local TableStats stats;
+
+/* An interned string and how many references there are to it: one
+ * for each VM with it in vm.strings, and one for each time a profile
+ * sample recorded it. */
+typedef struct {
+    ObjString   string;
+    _Atomic int refs;
+} Interned;
+
+// Left in the slot of a removed string. Lookups carry on past it.
+static ObjString removedString;
+#define TOMBSTONE (&removedString)
+
+typedef struct SlotArray {
+    int               capacity; // Always a power of two.
+    struct SlotArray* next;     // On the stripe's list to free.
+    _Atomic(ObjString*) slots[];
+} SlotArray;
+
+/* A stripe is a linear-probing set of strings.
+ *
+ * Readers load `array` and `old` and probe them without locking.
+ * Writers hold `lock`, publish fully built strings with a release
+ * store into an empty slot, and publish a bigger array the same way
+ * when growing. The replaced array becomes `old` until its strings
+ * have all been copied across, a few slots per insert, so a string is
+ * always in one of the two.
+ *
+ * A string is removed when its last reference is released, leaving a
+ * tombstone in both arrays. Readers might still be looking at it, or
+ * at an array that has been replaced, so those wait on `garbage` and
+ * `retired` to be freed once every lookup that started before they
+ * were unlinked has finished. Lookups count themselves in
+ * `readers[epoch & 1]`; waitForReaders() moves new lookups on to the
+ * other counter and waits for the old one to drain. */
+typedef struct {
+    pthread_mutex_t     lock;
+    _Atomic(SlotArray*) array;
+    _Atomic(SlotArray*) old;      // NULL unless migrating.
+    int                 migrated; // Slots of `old` copied so far.
+    SlotArray*          next;     // The next array, being cleared.
+    int                 prepared; // Slots of `next` cleared so far.
+    int                 count;    // Strings in the stripe.
+    int                 used;     // Slots of `array` ever filled.
+
+    _Atomic int readers[2];
+    _Atomic int epoch;
+    Obj*        garbage;  // Removed strings, linked through obj.next.
+    SlotArray*  retired;  // Replaced arrays, linked through `next`.
+    int         unfreed;  // How many are on the two lists.
+} Stripe;
+
+// Initialised statically, since lookups don't take the lock and so
+// can come before anything else has touched a stripe. Everything but
+// the lock starts out zero.
+static Stripe stripes[INTERN_STRIPES] = {
+    [0 ... INTERN_STRIPES - 1] = {.lock = PTHREAD_MUTEX_INITIALIZER},
+};
+
+/* Start a lookup that doesn't hold the lock. Returns the counter to
+ * pass to endRead. */
+static int beginRead(Stripe* stripe) {
+    for (;;) {
+        int epoch = atomic_load_explicit(&stripe->epoch,
+                                         memory_order_relaxed);
+        atomic_fetch_add_explicit(&stripe->readers[epoch & 1], 1,
+                                  memory_order_relaxed);
+        // Pairs with the fence in waitForReaders(): either it sees
+        // this lookup in `readers`, or this lookup sees the new epoch
+        // and everything unlinked before it.
+        atomic_thread_fence(memory_order_seq_cst);
+
+        // If a writer moved the epoch on in between, it may already
+        // have waited for this counter to drain: count in the new one.
+        if (atomic_load_explicit(&stripe->epoch,
+                                 memory_order_relaxed) == epoch) {
+            return epoch & 1;
+        }
+        atomic_fetch_sub_explicit(&stripe->readers[epoch & 1], 1,
+                                  memory_order_relaxed);
+    }
+}
+
+static void endRead(Stripe* stripe, int epoch) {
+    atomic_fetch_sub_explicit(&stripe->readers[epoch], 1,
+                              memory_order_release);
+}
+
+/* Wait until no lookup can still see what has been unlinked from the
+ * stripe so far. Called with the lock held; lookups don't take it, so
+ * they always finish. */
+static void waitForReaders(Stripe* stripe) {
+    int epoch = atomic_load_explicit(&stripe->epoch,
+                                     memory_order_relaxed);
+    atomic_store_explicit(&stripe->epoch, epoch + 1,
+                          memory_order_relaxed);
+    // After the store, so that it orders both the unlinking and the
+    // new epoch before reading the counter.
+    atomic_thread_fence(memory_order_seq_cst);
+
+    // Lookups from now on count in the other counter, so this one
+    // only goes down.
+    while (atomic_load_explicit(&stripe->readers[epoch & 1],
+                                memory_order_acquire) != 0) {
+        sched_yield();
+    }
+}
+
+static void freeString(ObjString* string) {
+    FREE_ARRAY(char, string->chars, string->length + 1);
+    FREE(Interned, string);
+}
+
+static void freeSlotArray(SlotArray* array) {
+    reallocate(array, sizeof(SlotArray) +
+               sizeof(_Atomic(ObjString*)) * array->capacity, 0);
+}
+
+/* Free what has been removed from the stripe, once nothing can be
+ * reading it. Only worth a wait when there's a batch of it. */
+static void freeUnlinked(Stripe* stripe, bool now) {
+    if (stripe->unfreed == 0) return;
+    if (!now && stripe->unfreed < INTERN_FREE_BATCH) return;
+
+    waitForReaders(stripe);
+
+    while (stripe->garbage != NULL) {
+        Obj* next = stripe->garbage->next;
+        freeString((ObjString*)stripe->garbage);
+        stripe->garbage = next;
+    }
+    while (stripe->retired != NULL) {
+        SlotArray* next = stripe->retired->next;
+        freeSlotArray(stripe->retired);
+        stripe->retired = next;
+    }
+    stripe->unfreed = 0;
+}
+
+/* An array whose slots still need clearing with clearSlots. */
+static SlotArray* newSlotArray(int capacity) {
+    SlotArray* array = (SlotArray*)reallocate(NULL, 0,
+        sizeof(SlotArray) + sizeof(_Atomic(ObjString*)) * capacity);
+    array->capacity = capacity;
+    array->next     = NULL;
+    return array;
+}
+
+static void clearSlots(SlotArray* array, int from, int to) {
+    for (int i = from; i < to; ++i) {
+        atomic_init(&array->slots[i], NULL);
+    }
+}
+
+static bool isString(ObjString* string, const char* chars, int length,
+                     uint32_t hash) {
+    return string != TOMBSTONE && string->hash == hash &&
+           string->length == length &&
+           memcmp(string->chars, chars, length) == 0;
+}
+
+static ObjString* findIn(SlotArray* array, const char* chars,
+                         int length, uint32_t hash) {
+    if (array == NULL) return NULL;
+
+    uint32_t mask  = array->capacity - 1;
+    uint32_t index = SLOT_HASH(hash) & mask;
+
+    for (;;) {
+        COUNT_PROBE();
+        ObjString* string = atomic_load_explicit(&array->slots[index],
+                                                 memory_order_acquire);
+        // Removed strings leave tombstones, so an empty slot ends the
+        // chain.
+        if (string == NULL) return NULL;
+        if (isString(string, chars, length, hash)) return string;
+
+        index = (index + 1) & mask;
+    }
+}
+
+/* How many slots a lookup would look at: up to the string,
+ * or up to an empty slot if it isn't there. Walked separately from
+ * findIn so lookups don't pay for counting when stats are off.
+ * A stripe with no array yet counts as one probe, like an empty slot,
+ * so every lookup lands in the histogram. */
+static int probeLength(SlotArray* array, const char* chars, int length,
+                       uint32_t hash) {
+    if (array == NULL) return 1;
+
+    uint32_t mask  = array->capacity - 1;
+    uint32_t index = SLOT_HASH(hash) & mask;
+    for (int probes = 1;; probes++) {
+        ObjString* string = atomic_load_explicit(&array->slots[index],
+                                                 memory_order_acquire);
+        if (string == NULL) return probes;
+        if (isString(string, chars, length, hash)) return probes;
+
+        index = (index + 1) & mask;
+    }
+}
+
+/* Put `string` in the first empty slot or tombstone of its chain.
+ * Only called with the stripe lock held, or on an array nobody else
+ * can see yet. Returns true if it filled an empty slot. */
+static bool insertInto(SlotArray* array, ObjString* string) {
+    uint32_t mask  = array->capacity - 1;
+    uint32_t index = SLOT_HASH(string->hash) & mask;
+
+    COUNT_PROBE();
+    for (;;) {
+        ObjString* slot = atomic_load_explicit(&array->slots[index],
+                                               memory_order_relaxed);
+        if (slot == NULL || slot == TOMBSTONE) {
+            atomic_store_explicit(&array->slots[index], string,
+                                  memory_order_release);
+            return slot == NULL;
+        }
+        COUNT_PROBE();
+        index = (index + 1) & mask;
+    }
+}
+
+/* Replace `string`'s slot in `array`, if it has one, by a tombstone. */
+static void removeFrom(SlotArray* array, ObjString* string) {
+    if (array == NULL) return;
+
+    uint32_t mask  = array->capacity - 1;
+    uint32_t index = SLOT_HASH(string->hash) & mask;
+    for (;;) {
+        ObjString* slot = atomic_load_explicit(&array->slots[index],
+                                               memory_order_relaxed);
+        if (slot == NULL) return;
+        if (slot == string) {
+            atomic_store_explicit(&array->slots[index], TOMBSTONE,
+                                  memory_order_relaxed);
+            return;
+        }
+        index = (index + 1) & mask;
+    }
+}
+
+/* How big the next array should be. A stripe that filled up with
+ * tombstones rather than strings is rebuilt at the same size. */
+static int nextCapacity(Stripe* stripe, SlotArray* array) {
+    if (array == NULL) return INTERN_INITIAL_CAPACITY;
+    if (stripe->count + 1 > array->capacity * INTERN_MAX_LOAD / 2) {
+        return array->capacity * 2;
+    }
+    return array->capacity;
+}
+
+/* Clear the next INTERN_PREPARE_SLOTS slots of the array the stripe
+ * will grow into, which has `capacity` slots. */
+static void prepareChunk(Stripe* stripe, int capacity) {
+    // Nobody else has seen it, so a wrong-sized one can just go.
+    if (stripe->next != NULL && stripe->next->capacity != capacity) {
+        freeSlotArray(stripe->next);
+        stripe->next = NULL;
+    }
+    if (stripe->next == NULL) {
+        stripe->next     = newSlotArray(capacity);
+        stripe->prepared = 0;
+    }
+
+    int to = stripe->prepared + INTERN_PREPARE_SLOTS;
+    if (to > capacity) to = capacity;
+    clearSlots(stripe->next, stripe->prepared, to);
+    stripe->prepared = to;
+}
+
+/* Keep clearing the next array once the stripe is getting full. It's
+ * done long before the stripe reaches INTERN_MAX_LOAD. */
+static void prepareGrowth(Stripe* stripe, SlotArray* array) {
+    if (stripe->used < array->capacity * INTERN_PREPARE_LOAD) return;
+
+    int capacity = nextCapacity(stripe, array);
+    if (stripe->next != NULL && stripe->next->capacity == capacity &&
+            stripe->prepared == capacity) {
+        return;
+    }
+    prepareChunk(stripe, capacity);
+}
+
+/* Copy the next `slots` slots of the old array into `array`, and stop
+ * looking in the old array once all of it has been copied. */
+static void migrate(Stripe* stripe, SlotArray* array, int slots) {
+    SlotArray* old = atomic_load_explicit(&stripe->old,
+                                          memory_order_relaxed);
+    if (old == NULL) return;
+
+    int end = stripe->migrated + slots;
+    if (end > old->capacity) end = old->capacity;
+
+    for (int i = stripe->migrated; i < end; ++i) {
+        ObjString* string = atomic_load_explicit(&old->slots[i],
+                                                 memory_order_relaxed);
+        if (string == NULL || string == TOMBSTONE) continue;
+        if (insertInto(array, string)) stripe->used++;
+    }
+    stripe->migrated = end;
+
+    // Readers that see NULL here see every string copied above.
+    if (end == old->capacity) {
+        atomic_store_explicit(&stripe->old, NULL, memory_order_release);
+        old->next       = stripe->retired;
+        stripe->retired = old;
+        stripe->unfreed++;
+    }
+}
+
+/* Swap in a new array, normally twice the size. The old one stays
+ * readable, and its strings are copied across a few at a time by
+ * later inserts. */
+static SlotArray* growStripe(Stripe* stripe, SlotArray* old) {
+    if (trackStats && old != NULL) stats.resizes++;
+
+    double start = traceEnabled ? traceNow() : 0;
+
+    // Can't happen with the migration rate above, but only ever have
+    // one old array to look in.
+    if (old != NULL) migrate(stripe, old, old->capacity);
+
+    // Normally prepareGrowth() has already cleared all of it.
+    int capacity = nextCapacity(stripe, old);
+    while (stripe->next == NULL || stripe->next->capacity != capacity ||
+               stripe->prepared < capacity) {
+        prepareChunk(stripe, capacity);
+    }
+    SlotArray* array = stripe->next;
+    stripe->next     = NULL;
+    stripe->prepared = 0;
+    stripe->used     = 0;
+
+    // Stored before `array`, so readers that see the new array see
+    // this too.
+    stripe->migrated = 0;
+    atomic_store_explicit(&stripe->old, old, memory_order_relaxed);
+    atomic_store_explicit(&stripe->array, array, memory_order_release);
+
+    if (traceEnabled && old != NULL) {
+        char args[64];
+        snprintf(args, sizeof(args), "\"old\":%d,\"new\":%d",
+                 old->capacity, capacity);
+        traceSpan("internGrow", start, args);
+    }
+    return array;
+}
+
+/* Shared strings aren't on any VM's object list. */
+static ObjString* newString(char* chars, int length, uint32_t hash) {
+    Interned* interned = (Interned*)reallocate(NULL, 0, sizeof(Interned));
+    ObjString* string = &interned->string;
+    string->obj.type = OBJ_STRING;
+    string->obj.next = NULL;
+    string->length   = length;
+    string->chars    = chars;
+    string->hash     = hash;
+    atomic_init(&interned->refs, 1);
+    return string;
+}
+
+/* Take a reference to `string`, unless its last one has already been
+ * released: it's on its way out, and a lookup must not bring it back. */
+static bool tryRetain(ObjString* string) {
+    _Atomic int* refs = &((Interned*)string)->refs;
+    int count = atomic_load_explicit(refs, memory_order_relaxed);
+    while (count > 0) {
+        if (atomic_compare_exchange_weak_explicit(refs, &count, count + 1,
+                memory_order_relaxed, memory_order_relaxed)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Find a string and take a reference to it, without locking. */
+static ObjString* findAndRetain(const char* chars, int length,
+                                uint32_t hash) {
+    Stripe* stripe = &stripes[STRIPE_OF(hash)];
+    int     epoch  = beginRead(stripe);
+
+    // `array` first: if it's a new array, `old` is then either the one
+    // it replaced or NULL once all of that has been copied into it.
+    SlotArray* array = atomic_load_explicit(&stripe->array,
+                                            memory_order_acquire);
+    SlotArray* old   = atomic_load_explicit(&stripe->old,
+                                            memory_order_acquire);
+
+    ObjString* string   = findIn(array, chars, length, hash);
+    bool       checkOld = string == NULL && old != NULL;
+    if (checkOld) string = findIn(old, chars, length, hash);
+
+    if (trackStats) {
+        int probes = probeLength(array, chars, length, hash);
+        if (checkOld) probes += probeLength(old, chars, length, hash);
+        recordProbes(&stats, probes);
+    }
+
+    if (string != NULL && !tryRetain(string)) string = NULL;
+    endRead(stripe, epoch);
+    return string;
+}
+
+/* Find or add a string. `owned` is either a heap copy of `chars` the
+ * table can keep, or NULL to make one if the string is new. */
+static ObjString* intern(const char* chars, int length, uint32_t hash,
+                         char* owned) {
+    ObjString* string = findAndRetain(chars, length, hash);
+    if (string != NULL) {
+        if (owned != NULL) FREE_ARRAY(char, owned, length + 1);
+        return string;
+    }
+
+    Stripe* stripe = &stripes[STRIPE_OF(hash)];
+    pthread_mutex_lock(&stripe->lock);
+
+    // Another thread may have added it since we looked. Strings only
+    // lose their last reference with the lock held, so one that's
+    // still here can be retained.
+    SlotArray* array = atomic_load_explicit(&stripe->array,
+                                            memory_order_relaxed);
+    SlotArray* old   = atomic_load_explicit(&stripe->old,
+                                            memory_order_relaxed);
+    string = findIn(array, chars, length, hash);
+    if (string == NULL) string = findIn(old, chars, length, hash);
+    if (string != NULL) {
+        atomic_fetch_add_explicit(&((Interned*)string)->refs, 1,
+                                  memory_order_relaxed);
+        pthread_mutex_unlock(&stripe->lock);
+        if (owned != NULL) FREE_ARRAY(char, owned, length + 1);
+        return string;
+    }
+
+    if (array == NULL ||
+            stripe->used + 1 > array->capacity * INTERN_MAX_LOAD) {
+        array = growStripe(stripe, array);
+    } else {
+        prepareGrowth(stripe, array);
+    }
+    migrate(stripe, array, INTERN_MIGRATE_SLOTS);
+
+    if (owned == NULL) {
+        owned = ALLOCATE(char, length + 1);
+        memcpy(owned, chars, length);
+        owned[length] = '\0';
+    }
+    string = newString(owned, length, hash);
+    if (insertInto(array, string)) stripe->used++;
+    stripe->count++;
+
+    freeUnlinked(stripe, false);
+    pthread_mutex_unlock(&stripe->lock);
+    return string;
+}
+
+ObjString* internCopy(const char* chars, int length, uint32_t hash) {
+    return intern(chars, length, hash, NULL);
+}
+
+ObjString* internTake(char* chars, int length, uint32_t hash) {
+    return intern(chars, length, hash, chars);
+}
+
+/* Take another reference to a string the caller already has one to
+ * (or that a running VM has). Only an atomic increment, so it's safe
+ * in a signal handler. */
+void internRetain(ObjString* string) {
+    atomic_fetch_add_explicit(&((Interned*)string)->refs, 1,
+                              memory_order_relaxed);
+}
+
+/* Give back a reference. The last one removes the string from the
+ * table, and it's freed once no lookup can be looking at it. */
+void internRelease(ObjString* string) {
+    _Atomic int* refs  = &((Interned*)string)->refs;
+    int          count = atomic_load_explicit(refs, memory_order_relaxed);
+    while (count > 1) {
+        if (atomic_compare_exchange_weak_explicit(refs, &count, count - 1,
+                memory_order_release, memory_order_relaxed)) {
+            return;
+        }
+    }
+
+    // Maybe the last one. Dropping it with the lock held means inserts
+    // can't find it in between, and lookups without the lock won't
+    // retain it once it's zero.
+    Stripe* stripe = &stripes[STRIPE_OF(string->hash)];
+    pthread_mutex_lock(&stripe->lock);
+    if (atomic_fetch_sub_explicit(refs, 1, memory_order_acq_rel) == 1) {
+        removeFrom(atomic_load_explicit(&stripe->array,
+                                        memory_order_relaxed), string);
+        removeFrom(atomic_load_explicit(&stripe->old,
+                                        memory_order_relaxed), string);
+        stripe->count--;
+
+        string->obj.next = stripe->garbage;
+        stripe->garbage  = &string->obj;
+        stripe->unfreed++;
+        freeUnlinked(stripe, false);
+    }
+    pthread_mutex_unlock(&stripe->lock);
+}
+
+/* Start counting lookups and probe lengths (see TableStats). */
+void internTrackStats() {
+    trackStats = true;
+}
+
+/* This thread's counters, and how many strings, slots and tombstones
+ * the whole table has. */
+TableStats internStats(int* count, int* capacity, int* tombstones) {
+    *count      = 0;
+    *capacity   = 0;
+    *tombstones = 0;
+    for (int i = 0; i < INTERN_STRIPES; ++i) {
+        pthread_mutex_lock(&stripes[i].lock);
+        SlotArray* array = atomic_load_explicit(&stripes[i].array,
+                                                memory_order_relaxed);
+        *count += stripes[i].count;
+        if (array != NULL) {
+            *capacity += array->capacity;
+            for (int j = 0; j < array->capacity; ++j) {
+                if (atomic_load_explicit(&array->slots[j],
+                        memory_order_relaxed) == TOMBSTONE) {
+                    (*tombstones)++;
+                }
+            }
+        }
+        pthread_mutex_unlock(&stripes[i].lock);
+    }
+    return stats;
+}
+
+int internCount() {
+    int count = 0;
+    for (int i = 0; i < INTERN_STRIPES; ++i) {
+        pthread_mutex_lock(&stripes[i].lock);
+        count += stripes[i].count;
+        pthread_mutex_unlock(&stripes[i].lock);
+    }
+    return count;
+}
+
+/* Free every interned string, whether or not it's still referenced.
+ * No VM may be running. */
+void freeInternTable() {
+    for (int i = 0; i < INTERN_STRIPES; ++i) {
+        Stripe* stripe = &stripes[i];
+        SlotArray* array = atomic_load(&stripe->array);
+
+        if (array != NULL) {
+            // Every string is then in `array` exactly once.
+            migrate(stripe, array, array->capacity);
+
+            for (int j = 0; j < array->capacity; ++j) {
+                ObjString* string = atomic_load(&array->slots[j]);
+                if (string == NULL || string == TOMBSTONE) continue;
+                freeString(string);
+            }
+            freeSlotArray(array);
+        }
+        freeUnlinked(stripe, true);
+
+        if (stripe->next != NULL) {
+            freeSlotArray(stripe->next);
+            stripe->next = NULL;
+        }
+        atomic_store(&stripe->array, NULL);
+        stripe->count = 0;
+        stripe->used  = 0;
+    }
+}
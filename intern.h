@@ -0,0 +1,39 @@
+#ifndef clox_intern_h
+#define clox_intern_h
+
+#include "common.h"
+#include "object.h"
+#include "table.h"
+
+/* Process-wide string intern table.
+ *
+ * Every VM in the process (one per thread) interns into the same
+ * table, so a given string is only ever allocated once and strings
+ * from different VMs can still be compared by pointer. Lookups take
+ * no locks; inserts lock one of INTERN_STRIPES stripes, picked by
+ * hash, so threads interning different strings rarely contend.
+ *
+ * Interned strings are reference counted. internCopy and internTake
+ * return a string with a reference for the caller, which a VM keeps
+ * in vm.strings and gives back with internRelease when it is reset
+ * or freed. A string goes once its last reference does, so a
+ * long-running process only holds the strings its VMs are using.
+ * `freeInternTable` frees whatever is left. */
+#define INTERN_STRIPES 64
+
+#ifdef PROBE_STATS
+// Slots examined by lookups and inserts on this thread. Only compiled
+// in for the microbenchmarks.
+extern _Thread_local uint64_t internProbes;
+#endif
+
+ObjString* internCopy(const char* chars, int length, uint32_t hash);
+ObjString* internTake(char* chars, int length, uint32_t hash);
+void       internRetain(ObjString* string);
+void       internRelease(ObjString* string);
+int        internCount();
+void       internTrackStats();
+TableStats internStats(int* count, int* capacity, int* tombstones);
+void       freeInternTable();
+
+#endif
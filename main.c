@@ -1,11 +1,23 @@
+#include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "common.h"
+#include "bench.h"
 #include "chunk.h"
+#include "compiler.h"
 #include "debug.h"
+#include "intern.h"
+#include "profile.h"
+#include "scheduler.h"
+#include "serve.h"
+#include "trace.h"
 #include "vm.h"
+#include "workers.h"
 
 static void repl() {
     char line[1024];
@@ -52,28 +64,319 @@ static char* readFile(const char* path) {
     return buffer;
 }
 
+/* Map a regular file read-only, followed by at least one zero byte so
+ * the scanner sees a terminated string.
+ *
+ * The whole range is first reserved as anonymous (zeroed) memory and
+ * the file is mapped over the front of it. Bytes after the end of the
+ * file in its last page read as zero too, so there's always a NUL
+ * even when the file fills its last page exactly.
+ *
+ * Returns NULL if the file can't be mapped (e.g. it's a pipe). */
+static char* mapFile(const char* path, size_t* mappedSize) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return NULL;
+
+    struct stat info;
+    if (fstat(fd, &info) != 0 || !S_ISREG(info.st_mode)) {
+        close(fd);
+        return NULL;
+    }
+
+    size_t fileSize = (size_t)info.st_size;
+    size_t pageSize = (size_t)sysconf(_SC_PAGESIZE);
+    size_t size     = (fileSize + 1 + pageSize - 1) / pageSize * pageSize;
+
+    char* base = mmap(NULL, size, PROT_READ,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (base == MAP_FAILED) {
+        close(fd);
+        return NULL;
+    }
+
+    if (fileSize > 0 &&
+            mmap(base, fileSize, PROT_READ, MAP_PRIVATE | MAP_FIXED,
+                 fd, 0) == MAP_FAILED) {
+        munmap(base, size);
+        close(fd);
+        return NULL;
+    }
+    close(fd);
+
+    // The scanner reads the source front to back exactly once.
+    madvise(base, fileSize, MADV_SEQUENTIAL);
+
+    *mappedSize = size;
+    return base;
+}
+
+// Compile and run one top-level declaration at a time (--stream).
+static bool streamSource = false;
+
+// Only compile the script, perhaps timing it (--compile-only, --timings).
+static bool compileOnlyMode = false;
+static bool timings         = false;
+
+// Run the script this many times and report timings (--repeat).
+static BenchOptions bench = {0};
+
+// Run the script on a daemon (--connect) instead of here.
+static const char* connectPath  = NULL;
+static bool        sendBytecode = false;
+
+// Run the script once per input, on this many processes (--workers).
+static int          workerCount = 1;
+static const char** inputs      = NULL;
+static int          inputCount  = 0;
+
+// Report on the globals and intern tables at exit (--table-stats).
+static bool tableStats = false;
+
+// Run every script given side by side on this thread (--tasks).
+static bool     runTasks          = false;
+static uint64_t sliceInstructions = SCHEDULER_DEFAULT_SLICE;
+static double   timeoutMs         = 0;
+static bool     taskStats         = false;
+
 static void runFile(const char* path) {
-    char* source = readFile(path);
-    InterpretResult result = interpret(source);
-    free(source);
+    size_t mappedSize = 0;
+    char* source = mapFile(path, &mappedSize);
+    if (source == NULL) source = readFile(path);
+
+    if (connectPath != NULL) {
+        int status = runClient(connectPath, source, sendBytecode);
+        if (status != 0) exit(status);
+        return;
+    }
+
+    if (inputCount > 0) {
+        ObjFunction* script = compile(source);
+        if (script == NULL) exit(65);
+        int status = runWorkers(script, inputs, inputCount, workerCount);
+        if (status != 0) exit(status);
+        return;
+    }
+
+    InterpretResult result;
+    if (compileOnlyMode) {
+        result = compileOnly(path, source, timings);
+    } else if (bench.repeat > 0) {
+        bench.stream = streamSource;
+        result = runRepeated(path, source, &bench);
+    } else {
+        result = streamSource ? interpretStream(source)
+                              : interpret(source);
+    }
+
+    if (mappedSize > 0) {
+        munmap(source, mappedSize);
+    } else {
+        free(source);
+    }
 
     if (result == INTERPRET_COMPILE_ERROR) exit(65);
     if (result == INTERPRET_RUNTIME_ERROR) exit(76);
 
 }
 
+/* Print --table-stats for the globals and the intern table. Called
+ * from main() before the VM is freed, or at exit for runs that stop
+ * early. */
+static void reportTableStats() {
+    if (!tableStats) return;
+    tableStats = false;
+
+    TableReport reports[2];
+    reports[0].name       = "globals";
+    reports[0].stats      = *vm.globals.stats;
+    reports[0].capacity   = vm.globals.capacity;
+    reports[0].tombstones = tableTombstones(&vm.globals);
+    reports[0].entries    = vm.globals.count - reports[0].tombstones;
+
+    reports[1].name       = "interned";
+    reports[1].stats      = internStats(&reports[1].entries,
+                                        &reports[1].capacity,
+                                        &reports[1].tombstones);
+
+    printTableStats(reports, 2);
+}
+
+/* Run the scripts at `paths` as tasks sharing this thread. */
+static void runTaskFiles(const char** paths, int count) {
+    Scheduler scheduler;
+    initScheduler(&scheduler);
+    scheduler.sliceInstructions = sliceInstructions;
+    scheduler.timeoutMs         = timeoutMs;
+
+    for (int i = 0; i < count; i++) {
+        char* source = readFile(paths[i]);
+        spawnTask(&scheduler, paths[i], source);
+        free(source);
+    }
+    runScheduler(&scheduler);
+    if (taskStats) printTaskStats(&scheduler, stderr);
+
+    // As for a single script, but for the first task that failed.
+    int status = 0;
+    for (int i = 0; i < scheduler.count && status == 0; i++) {
+        InterpretResult result = scheduler.tasks[i].result;
+        if (result == INTERPRET_COMPILE_ERROR) status = 65;
+        if (result == INTERPRET_RUNTIME_ERROR) status = 76;
+    }
+    freeScheduler(&scheduler);
+    if (status != 0) exit(status);
+}
+
+static void usage() {
+    fprintf(stderr, "Usage: clox [options] [path [inputs...]]\n"
+                    "\n"
+                    "Options:\n"
+                    "  --incremental-rehash  Grow tables a few slots at a time.\n"
+                    "  --stream              Compile and run one declaration at a time.\n"
+                    "  --line-buffered       Flush printed output after every line.\n"
+                    "  --output-buffer BYTES Size of the print buffer (default 64K).\n"
+                    "  --shortest-numbers    Print numbers in shortest round-trip form\n"
+                    "                        instead of %%g.\n"
+                    "  --hot-loops           Report how often each loop ran, to stderr.\n"
+                    "  --repeat N            Run the script N times on one VM and report\n"
+                    "                        wall time, instructions and peak memory.\n"
+                    "  --report FILE         Write the --repeat report (JSON) to FILE.\n"
+                    "  --compare FILE        Compare the --repeat results with a saved\n"
+                    "                        report.\n"
+                    "  --serve SOCKET        Run scripts sent to a Unix socket on warm VMs.\n"
+                    "  --serve-threads N     Number of VMs (threads) serving (default 1).\n"
+                    "  --connect SOCKET      Run the script on a --serve daemon.\n"
+                    "  --send-bytecode       With --connect, compile here and send bytecode.\n"
+                    "  --workers N           Run the script once per input, with the input\n"
+                    "                        in `input`, on N forked processes.\n"
+                    "  --tasks               Run all the scripts given at once, taking turns\n"
+                    "                        on one thread.\n"
+                    "  --slice N             Instructions per turn with --tasks (default %d).\n"
+                    "  --timeout MS          Stop any task that uses more CPU time than this.\n"
+                    "  --task-stats          Report each task's CPU time and turns, to stderr.\n"
+                    "  --trace-events FILE   Write a Chrome trace of compiling, running and\n"
+                    "                        table resizes to FILE.\n"
+                    "  --sample-profile FILE Sample the running line; print the hottest\n"
+                    "                        lines and write collapsed stacks to FILE.\n"
+                    "  --sample-rate HZ      Samples per CPU second (default %d).\n"
+                    "  --compile-only        Compile the script but don't run it.\n"
+                    "  --timings             With --compile-only, report the time taken by\n"
+                    "                        each phase and the size of the bytecode.\n"
+                    "  --pipeline-scanner    Scan on a second thread while compiling.\n"
+                    "  --table-stats         Report probe lengths, load and tombstones of the\n"
+                    "                        globals and intern tables, to stderr.\n",
+                    SCHEDULER_DEFAULT_SLICE, PROFILE_DEFAULT_HZ);
+    exit(64);
+}
+
 int main(int argc, const char* argv[]) {
     initVM();
 
-    if (argc == 1) {
+    const char* path         = NULL;
+    const char* servePath    = NULL;
+    const char* profilePath  = NULL;
+    int         profileHz    = PROFILE_DEFAULT_HZ;
+    int         serveThreads = 1;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--incremental-rehash") == 0) {
+            vm.globals.incremental = true;
+            vm.strings.incremental = true;
+        } else if (strcmp(argv[i], "--stream") == 0) {
+            streamSource = true;
+        } else if (strcmp(argv[i], "--line-buffered") == 0) {
+            vm.output.lineBuffered = true;
+        } else if (strcmp(argv[i], "--output-buffer") == 0 && i + 1 < argc) {
+            setOutputCapacity(&vm.output, atoi(argv[++i]));
+        } else if (strcmp(argv[i], "--shortest-numbers") == 0) {
+            vm.output.shortestNumbers = true;
+        } else if (strcmp(argv[i], "--hot-loops") == 0) {
+            vm.reportHotLoops = true;
+        } else if (strcmp(argv[i], "--repeat") == 0 && i + 1 < argc) {
+            bench.repeat = atoi(argv[++i]);
+            if (bench.repeat < 1) usage();
+        } else if (strcmp(argv[i], "--report") == 0 && i + 1 < argc) {
+            bench.reportPath = argv[++i];
+        } else if (strcmp(argv[i], "--compare") == 0 && i + 1 < argc) {
+            bench.comparePath = argv[++i];
+        } else if (strcmp(argv[i], "--serve") == 0 && i + 1 < argc) {
+            servePath = argv[++i];
+        } else if (strcmp(argv[i], "--serve-threads") == 0 && i + 1 < argc) {
+            serveThreads = atoi(argv[++i]);
+            if (serveThreads < 1) usage();
+        } else if (strcmp(argv[i], "--connect") == 0 && i + 1 < argc) {
+            connectPath = argv[++i];
+        } else if (strcmp(argv[i], "--send-bytecode") == 0) {
+            sendBytecode = true;
+        } else if (strcmp(argv[i], "--workers") == 0 && i + 1 < argc) {
+            workerCount = atoi(argv[++i]);
+            if (workerCount < 1) usage();
+        } else if (strcmp(argv[i], "--tasks") == 0) {
+            runTasks = true;
+        } else if (strcmp(argv[i], "--slice") == 0 && i + 1 < argc) {
+            long long slice = atoll(argv[++i]);
+            if (slice < 1) usage();
+            sliceInstructions = (uint64_t)slice;
+        } else if (strcmp(argv[i], "--timeout") == 0 && i + 1 < argc) {
+            timeoutMs = atof(argv[++i]);
+            if (timeoutMs <= 0) usage();
+        } else if (strcmp(argv[i], "--task-stats") == 0) {
+            taskStats = true;
+        } else if (strcmp(argv[i], "--trace-events") == 0 && i + 1 < argc) {
+            startTrace(argv[++i]);
+        } else if (strcmp(argv[i], "--sample-profile") == 0 && i + 1 < argc) {
+            profilePath = argv[++i];
+        } else if (strcmp(argv[i], "--pipeline-scanner") == 0) {
+            vm.pipelineScanner = true;
+        } else if (strcmp(argv[i], "--compile-only") == 0) {
+            compileOnlyMode = true;
+        } else if (strcmp(argv[i], "--timings") == 0) {
+            timings = true;
+        } else if (strcmp(argv[i], "--table-stats") == 0) {
+            if (!tableStats) atexit(reportTableStats);
+            tableStats = true;
+            tableTrackStats(&vm.globals);
+            internTrackStats();
+        } else if (strcmp(argv[i], "--sample-rate") == 0 && i + 1 < argc) {
+            profileHz = atoi(argv[++i]);
+            if (profileHz < 1) usage();
+        } else if (argv[i][0] != '-' && path == NULL) {
+            path = argv[i];
+        } else if (path != NULL) {
+            // Everything after the script is an input to it.
+            inputs     = &argv[i];
+            inputCount = argc - i;
+            break;
+        } else {
+            usage();
+        }
+    }
+
+    if (timings && !compileOnlyMode) usage();
+    // Nothing runs with --compile-only, so nothing to run it with.
+    if (compileOnlyMode && (inputCount > 0 || runTasks ||
+                            bench.repeat > 0 || connectPath != NULL ||
+                            servePath != NULL || streamSource)) {
+        usage();
+    }
+    if (profilePath != NULL) startProfile(profilePath, profileHz);
+
+    if (servePath != NULL) {
+        exit(serve(servePath, serveThreads));
+    } else if (path == NULL) {
         repl();
-    } else if (argc == 2) {
-        runFile(argv[1]);
+    } else if (runTasks) {
+        const char** paths = malloc(sizeof(const char*) * (inputCount + 1));
+        paths[0] = path;
+        memcpy(paths + 1, inputs, sizeof(const char*) * inputCount);
+        runTaskFiles(paths, inputCount + 1);
+        free(paths);
     } else {
-        fprintf(stderr, "Usage: clox [path]\n");
-        exit(64);
+        runFile(path);
     }
 
+    finishProfile();
+    reportTableStats();
     freeVM();
+    freeInternTable();
     return 0;
-}
\ No newline at end of file
+}
@@ -3,7 +3,11 @@
 #include "memory.h"
 #include "vm.h"
 
+_Thread_local int64_t bytesAllocated = 0;
+
 void* reallocate(void* pointer, size_t oldSize, size_t newSize) {
+    bytesAllocated += (int64_t)newSize - (int64_t)oldSize;
+
     if (newSize == 0) {
         free(pointer);
         return NULL;
@@ -16,6 +20,28 @@ void* reallocate(void* pointer, size_t oldSize, size_t newSize) {
 
 void freeObject(Obj* object) {
     switch (object->type) {
+        case OBJ_CLASS:
+            FREE(ObjClass, object);
+            break;
+        case OBJ_INSTANCE: {
+            ObjInstance* instance = (ObjInstance*)object;
+            FREE_ARRAY(Value, instance->fields, instance->fieldCapacity);
+            FREE(ObjInstance, object);
+            break;
+        }
+        case OBJ_SHAPE:
+            freeTable(&((Shape*)object)->transitions);
+            FREE(Shape, object);
+            break;
+        case OBJ_FUNCTION: {
+            ObjFunction* function = (ObjFunction*)object;
+            freeChunk(&function->chunk);
+            FREE(ObjFunction, object);
+            break;
+        }
+        case OBJ_NATIVE:
+            FREE(ObjNative, object);
+            break;
         case OBJ_STRING: {
             ObjString* string = (ObjString*)object;
             FREE_ARRAY(char, string->chars, string->length + 1);
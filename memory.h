@@ -21,6 +21,9 @@
 #define FREE_ARRAY(type, pointer, oldCount) \
     reallocate(pointer, sizeof(type) * (oldCount), 0)
 
+// Bytes allocated through reallocate, less those freed, on this thread.
+extern _Thread_local int64_t bytesAllocated;
+
 void* reallocate(void* pointer, size_t oldSize, size_t newSize);
 void freeObjects();
 
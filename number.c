@@ -0,0 +1,413 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "number.h"
+#include "pow5table.h"
+
+// Up to 19 decimal digits always fit in a uint64_t.
+#define MAX_DIGITS 19
+
+// Doubles hold integers up to 2^53, and powers of ten up to 10^22,
+// exactly.
+#define MAX_EXACT_INT  (1ull << 53)
+#define MAX_EXACT_POW10 22
+
+static const double exactPowersOfTen[] = {
+    1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10,
+    1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21,
+    1e22,
+};
+
+/* Slow but always correct: strtod on a terminated copy of the token.
+ *
+ * The copy keeps strtod from reading past the token (e.g. taking
+ * "1e5" as one number when Lox scanned it as "1" and "e5"). */
+static double parseSlow(const char* start, int length) {
+    char  small[64];
+    char* buffer = length < (int)sizeof(small)
+        ? small : (char*)malloc(length + 1);
+
+    memcpy(buffer, start, length);
+    buffer[length] = '\0';
+    double value = strtod(buffer, NULL);
+
+    if (buffer != small) free(buffer);
+    return value;
+}
+
+/* Eisel-Lemire: the correctly rounded double nearest mantissa * 10^exp.
+ *
+ * Multiplies the normalised mantissa by a 128-bit approximation of
+ * 5^exp and reads the result off the top bits. See Lemire, "Number
+ * Parsing at a Gigabyte per Second" (2021). Sets *ok to false when
+ * the answer would be subnormal, leaving it to the slow path. */
+static double eiselLemire(uint64_t mantissa, int exponent, bool* ok) {
+    int leadingZeros = __builtin_clzll(mantissa);
+    mantissa <<= leadingZeros;
+
+    const uint64_t* power = pow5table[exponent - POW5_SMALLEST_POWER];
+    __uint128_t product = (__uint128_t)mantissa * power[0];
+    uint64_t high = (uint64_t)(product >> 64);
+    uint64_t low  = (uint64_t)product;
+
+    // We need 55 good bits. If the ones below those are all set the
+    // rest of the 128-bit power might carry into them.
+    if ((high & 0x1FF) == 0x1FF) {
+        __uint128_t second = (__uint128_t)mantissa * power[1];
+        uint64_t secondHigh = (uint64_t)(second >> 64);
+        low += secondHigh;
+        if (secondHigh > low) high++;
+    }
+
+    int upperBit = (int)(high >> 63);
+    int shift    = upperBit + 64 - 52 - 3;
+    uint64_t bits = high >> shift;
+
+    // floor(log2(10^exponent)) + 63, then the IEEE bias.
+    int power2 = (((152170 + 65536) * exponent) >> 16) + 63 +
+                 upperBit - leadingZeros + 1023;
+    if (power2 <= 0) {
+        *ok = false;
+        return 0;
+    }
+
+    // Exactly halfway: round to even rather than up.
+    if (low <= 1 && exponent >= -4 && exponent <= 23 &&
+            (bits & 3) == 1 && (bits << shift) == high) {
+        bits &= ~1ull;
+    }
+
+    bits += bits & 1;
+    bits >>= 1;
+    if (bits >= (2ull << 52)) {
+        bits = 1ull << 52;
+        power2++;
+    }
+    bits &= ~(1ull << 52);
+
+    if (power2 >= 0x7FF) {
+        bits   = 0;
+        power2 = 0x7FF; // Infinity.
+    }
+
+    bits |= (uint64_t)power2 << 52;
+    double value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+/* Parse a Lox number literal: digits, optionally '.' and more digits.
+ *
+ * Gives exactly the same double as strtod, but only looks at the
+ * token and doesn't depend on the locale. Literals of up to 15 or so
+ * digits are a single multiply or divide; longer ones go through
+ * Eisel-Lemire, and only literals with more than 19 significant
+ * digits (or subnormal results) fall back to strtod. */
+double parseNumber(const char* start, int length) {
+    const char* current = start;
+    const char* end     = start + length;
+
+    uint64_t mantissa  = 0;
+    int      digits    = 0; // Significant digits in `mantissa`.
+    int      exponent  = 0;
+    bool     truncated = false;
+
+    for (; current < end && *current != '.'; current++) {
+        if (digits < MAX_DIGITS) {
+            mantissa = mantissa * 10 + (*current - '0');
+            if (mantissa != 0) digits++;
+        } else {
+            exponent++;
+            if (*current != '0') truncated = true;
+        }
+    }
+
+    if (current < end) {
+        // Skip the '.'.
+        for (current++; current < end; current++) {
+            if (digits < MAX_DIGITS) {
+                mantissa = mantissa * 10 + (*current - '0');
+                if (mantissa != 0) digits++;
+                exponent--;
+            } else if (*current != '0') {
+                truncated = true;
+            }
+        }
+    }
+
+    if (truncated) return parseSlow(start, length);
+    if (mantissa == 0) return 0.0;
+
+    // Clinger's fast path: both operands are exact, so one correctly
+    // rounded operation gives the correctly rounded result.
+    if (mantissa <= MAX_EXACT_INT &&
+            exponent >= -MAX_EXACT_POW10 && exponent <= MAX_EXACT_POW10) {
+        double value = (double)mantissa;
+        return exponent < 0 ? value / exactPowersOfTen[-exponent]
+                            : value * exactPowersOfTen[exponent];
+    }
+
+    if (exponent >= POW5_SMALLEST_POWER && exponent <= POW5_LARGEST_POWER) {
+        bool   ok    = true;
+        double value = eiselLemire(mantissa, exponent, &ok);
+        if (ok) return value;
+    }
+
+    return parseSlow(start, length);
+}
+
+/* Ryu: the shortest decimal that reads back as the same double.
+ *
+ * A port of Ulf Adams' d2s (PLDI 2018) without the small-integer
+ * special case. Computes the decimal digits (as an integer) and the
+ * power of ten of a finite, non-zero double's magnitude. */
+static inline int pow5Bits(int e) {
+    return ((e * 1217359) >> 19) + 1;
+}
+
+static inline int log10Pow2(int e) {
+    return (e * 78913) >> 18;
+}
+
+static inline int log10Pow5(int e) {
+    return (e * 732923) >> 20;
+}
+
+static inline int pow5Factor(uint64_t value) {
+    int count = 0;
+    while (value % 5 == 0) {
+        value /= 5;
+        count++;
+    }
+    return count;
+}
+
+static inline bool multipleOfPowerOf5(uint64_t value, int p) {
+    return pow5Factor(value) >= p;
+}
+
+static inline bool multipleOfPowerOf2(uint64_t value, int p) {
+    return (value & ((1ull << p) - 1)) == 0;
+}
+
+// (m * mul) >> j, where mul is a 128-bit {low, high} and j >= 64.
+static inline uint64_t mulShift64(uint64_t m, const uint64_t* mul,
+                                  int j) {
+    __uint128_t low  = (__uint128_t)m * mul[0];
+    __uint128_t high = (__uint128_t)m * mul[1];
+    return (uint64_t)(((low >> 64) + high) >> (j - 64));
+}
+
+static void shortestDecimal(uint64_t ieeeMantissa, int ieeeExponent,
+                            uint64_t* digits, int* exponent10) {
+    int      e2;
+    uint64_t m2;
+    if (ieeeExponent == 0) {
+        e2 = 1 - 1023 - 52 - 2;
+        m2 = ieeeMantissa;
+    } else {
+        e2 = ieeeExponent - 1023 - 52 - 2;
+        m2 = (1ull << 52) | ieeeMantissa;
+    }
+    bool acceptBounds = (m2 & 1) == 0;
+
+    // The interval of decimals that round to this double, times four.
+    uint64_t mv      = 4 * m2;
+    int      mmShift = ieeeMantissa != 0 || ieeeExponent <= 1;
+
+    uint64_t vr, vp, vm;
+    int      e10;
+    bool     vmIsTrailingZeros = false;
+    bool     vrIsTrailingZeros = false;
+
+    if (e2 >= 0) {
+        int q = log10Pow2(e2) - (e2 > 3);
+        e10 = q;
+        int k = RYU_POW5_INV_BITCOUNT + pow5Bits(q) - 1;
+        int i = -e2 + q + k;
+        vr = mulShift64(4 * m2, ryuPow5InvSplit[q], i);
+        vp = mulShift64(4 * m2 + 2, ryuPow5InvSplit[q], i);
+        vm = mulShift64(4 * m2 - 1 - mmShift, ryuPow5InvSplit[q], i);
+        if (q <= 21) {
+            // Only one of mp, mv, and mm can be a multiple of 5.
+            if (mv % 5 == 0) {
+                vrIsTrailingZeros = multipleOfPowerOf5(mv, q);
+            } else if (acceptBounds) {
+                vmIsTrailingZeros = multipleOfPowerOf5(mv - 1 - mmShift, q);
+            } else {
+                vp -= multipleOfPowerOf5(mv + 2, q);
+            }
+        }
+    } else {
+        int q = log10Pow5(-e2) - (-e2 > 1);
+        e10 = q + e2;
+        int i = -e2 - q;
+        int k = pow5Bits(i) - RYU_POW5_BITCOUNT;
+        int j = q - k;
+        vr = mulShift64(4 * m2, ryuPow5Split[i], j);
+        vp = mulShift64(4 * m2 + 2, ryuPow5Split[i], j);
+        vm = mulShift64(4 * m2 - 1 - mmShift, ryuPow5Split[i], j);
+        if (q <= 1) {
+            // mv has at least q trailing zeros in binary.
+            vrIsTrailingZeros = true;
+            if (acceptBounds) {
+                vmIsTrailingZeros = mmShift == 1;
+            } else {
+                --vp;
+            }
+        } else if (q < 63) {
+            vrIsTrailingZeros = multipleOfPowerOf2(mv, q);
+        }
+    }
+
+    // Drop digits while the interval still contains a shorter decimal.
+    int      removed           = 0;
+    uint8_t  lastRemovedDigit  = 0;
+    uint64_t output;
+
+    if (vmIsTrailingZeros || vrIsTrailingZeros) {
+        for (; vp / 10 > vm / 10; ++removed) {
+            vmIsTrailingZeros &= vm % 10 == 0;
+            vrIsTrailingZeros &= lastRemovedDigit == 0;
+            lastRemovedDigit = (uint8_t)(vr % 10);
+            vr /= 10;
+            vp /= 10;
+            vm /= 10;
+        }
+        if (vmIsTrailingZeros) {
+            for (; vm % 10 == 0; ++removed) {
+                vrIsTrailingZeros &= lastRemovedDigit == 0;
+                lastRemovedDigit = (uint8_t)(vr % 10);
+                vr /= 10;
+                vp /= 10;
+                vm /= 10;
+            }
+        }
+        if (vrIsTrailingZeros && lastRemovedDigit == 5 && vr % 2 == 0) {
+            // Exactly halfway: round to even.
+            lastRemovedDigit = 4;
+        }
+        output = vr + ((vr == vm && (!acceptBounds || !vmIsTrailingZeros))
+                       || lastRemovedDigit >= 5);
+    } else {
+        // The common case, where no exact ties are possible.
+        bool roundUp = false;
+        if (vp / 100 > vm / 100) {
+            roundUp = vr % 100 >= 50;
+            vr /= 100;
+            vp /= 100;
+            vm /= 100;
+            removed += 2;
+        }
+        for (; vp / 10 > vm / 10; ++removed) {
+            roundUp = vr % 10 >= 5;
+            vr /= 10;
+            vp /= 10;
+            vm /= 10;
+        }
+        output = vr + (vr == vm || roundUp);
+    }
+
+    *digits     = output;
+    *exponent10 = e10 + removed;
+}
+
+/* Write `count` digits of `digits` to `buffer` as a %g would, given
+ * that the leading digit is worth 10^exponent. `precision` is the
+ * %g precision, which decides between fixed and scientific form. */
+static int writeDigits(char* buffer, uint64_t digits, int count,
+                       int exponent, int precision) {
+    char text[20];
+    for (int i = count - 1; i >= 0; --i) {
+        text[i] = (char)('0' + digits % 10);
+        digits /= 10;
+    }
+
+    char* out = buffer;
+    if (exponent < -4 || exponent >= precision) {
+        *out++ = text[0];
+        if (count > 1) {
+            *out++ = '.';
+            memcpy(out, text + 1, count - 1);
+            out += count - 1;
+        }
+        *out++ = 'e';
+        *out++ = exponent < 0 ? '-' : '+';
+        int magnitude = exponent < 0 ? -exponent : exponent;
+        if (magnitude >= 100) *out++ = (char)('0' + magnitude / 100);
+        *out++ = (char)('0' + magnitude / 10 % 10);
+        *out++ = (char)('0' + magnitude % 10);
+    } else if (exponent < 0) {
+        *out++ = '0';
+        *out++ = '.';
+        for (int i = -1; i > exponent; --i) *out++ = '0';
+        memcpy(out, text, count);
+        out += count;
+    } else {
+        int whole = exponent + 1;
+        for (int i = 0; i < whole; ++i) {
+            *out++ = i < count ? text[i] : '0';
+        }
+        if (count > whole) {
+            *out++ = '.';
+            memcpy(out, text + whole, count - whole);
+            out += count - whole;
+        }
+    }
+    return (int)(out - buffer);
+}
+
+/* Format a number for printing into `buffer`, which must hold at
+ * least NUMBER_BUFFER_SIZE bytes, and return its length.
+ *
+ * By default the result is byte-for-byte what printf("%g") gives.
+ * It comes from the shortest round-trip digits whenever there are
+ * six or fewer of them, which rounding to six digits can't change,
+ * and from snprintf otherwise. With `shortest` every number is
+ * printed with its shortest round-trip digits instead, in fixed
+ * notation from 1e-4 up to 1e17 and scientific outside that. */
+int formatNumber(double value, char* buffer, bool shortest) {
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    bool     negative     = (bits >> 63) != 0;
+    int      ieeeExponent = (int)((bits >> 52) & 0x7FF);
+    uint64_t ieeeMantissa = bits & ((1ull << 52) - 1);
+
+    char* out = buffer;
+    if (negative) *out++ = '-';
+
+    if (ieeeExponent == 0 && ieeeMantissa == 0) {
+        *out++ = '0';
+        *out = '\0';
+        return (int)(out - buffer);
+    }
+
+    // Leave infinities and NaNs to the C library. So too subnormals
+    // for %g: they carry too few bits for the argument below to hold.
+    if (ieeeExponent == 0x7FF || (ieeeExponent == 0 && !shortest)) {
+        return snprintf(buffer, NUMBER_BUFFER_SIZE, "%g", value);
+    }
+
+    uint64_t digits;
+    int      exponent;
+    shortestDecimal(ieeeMantissa, ieeeExponent, &digits, &exponent);
+
+    // %g never prints trailing zeros after the point.
+    while (digits % 10 == 0) {
+        digits /= 10;
+        exponent++;
+    }
+
+    int count = 1;
+    for (uint64_t rest = digits / 10; rest != 0; rest /= 10) count++;
+
+    if (!shortest && count > 6) {
+        return snprintf(buffer, NUMBER_BUFFER_SIZE, "%g", value);
+    }
+
+    out += writeDigits(out, digits, count, exponent + count - 1,
+                       shortest ? 17 : 6);
+    *out = '\0';
+    return (int)(out - buffer);
+}
@@ -0,0 +1,12 @@
+#ifndef clox_number_h
+#define clox_number_h
+
+#include "common.h"
+
+// Longest formatNumber result, plus the terminator.
+#define NUMBER_BUFFER_SIZE 32
+
+double parseNumber(const char* start, int length);
+int    formatNumber(double value, char* buffer, bool shortest);
+
+#endif
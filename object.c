@@ -1,9 +1,9 @@
 #include <stdio.h>
 #include <string.h>
 
+#include "intern.h"
 #include "memory.h"
 #include "object.h"
-#include "table.h"
 #include "value.h"
 #include "vm.h"
 
@@ -18,61 +18,294 @@ static Obj* allocateObject(size_t size, ObjType type) {
     // This object points to the head of the linked-list.
     object->next = vm.objects;
     vm.objects = object;
+    vm.objectCount++;
     return object;
 }
 
+static Shape* newShape(Shape* parent, ObjString* key) {
+    Shape* shape = ALLOCATE_OBJ(Shape, OBJ_SHAPE);
+    shape->parent    = parent;
+    shape->key       = key;
+    shape->slotCount = parent == NULL ? 0 : parent->slotCount + 1;
+    initTable(&shape->transitions);
+    return shape;
+}
 
-static ObjString* allocateString(char* chars, int length,
-                                 uint32_t hash) {
-    ObjString* string = ALLOCATE_OBJ(ObjString, OBJ_STRING);
-    string->length = length;
-    string->chars  = chars;
-    string->hash   = hash;
-    
-    return string;
+ObjClass* newClass(ObjString* name) {
+    ObjClass* klass = ALLOCATE_OBJ(ObjClass, OBJ_CLASS);
+    klass->name      = name;
+    klass->rootShape = newShape(NULL, NULL);
+    return klass;
 }
 
-/* FNV-1a hash-function */
-static uint32_t hashString(const char* key, int length) {
-    uint32_t hash = 2166136261u;
+ObjInstance* newInstance(ObjClass* klass) {
+    ObjInstance* instance = ALLOCATE_OBJ(ObjInstance, OBJ_INSTANCE);
+    instance->klass         = klass;
+    instance->shape         = klass->rootShape;
+    instance->fields        = NULL;
+    instance->fieldCapacity = 0;
+    return instance;
+}
 
-    for (int i = 0; i < length; ++i) {
-        hash ^= key[i];
-        hash *= 16777619;
+/* The slot holding field `key` in instances of `shape`, or -1 if it
+ * has no such field. This walks the shape's ancestors, so it's for
+ * inline cache misses only. */
+int shapeFind(Shape* shape, ObjString* key) {
+    for (; shape->parent != NULL; shape = shape->parent) {
+        if (shape->key == key) return shape->slotCount - 1;
     }
-    return hash;
+    return -1;
 }
 
-ObjString* takeString(char* chars, int length) {
-    uint32_t hash = hashString(chars, length);
-    ObjString* interned = tableFindString(&vm.strings, chars, length,
-                                          hash);
+/* The shape reached from `shape` by adding field `key`. */
+Shape* shapeAdd(Shape* shape, ObjString* key) {
+    Value child;
+    if (tableGet(&shape->transitions, key, &child)) {
+        return (Shape*)AS_OBJ(child);
+    }
+
+    Shape* added = newShape(shape, key);
+    tableSet(&shape->transitions, key, OBJ_VAL(added));
+    return added;
+}
+
+/* Move `instance` to `shape`, a descendant of its current shape, making
+ * room for the new fields. */
+void instanceSetShape(ObjInstance* instance, Shape* shape) {
+    if (shape->slotCount > instance->fieldCapacity) {
+        int oldCapacity = instance->fieldCapacity;
+        instance->fieldCapacity = GROW_CAPACITY(oldCapacity);
+        if (instance->fieldCapacity < shape->slotCount) {
+            instance->fieldCapacity = shape->slotCount;
+        }
+        instance->fields = GROW_ARRAY(Value, instance->fields,
+                                      oldCapacity,
+                                      instance->fieldCapacity);
+    }
+    instance->shape = shape;
+}
+
+ObjFunction* newFunction() {
+    ObjFunction* function = ALLOCATE_OBJ(ObjFunction, OBJ_FUNCTION);
+    function->arity = 0;
+    function->name  = NULL;
+    initChunk(&function->chunk);
+    return function;
+}
+
+ObjNative* newNative(NativeFn function, int arity, ObjString* name) {
+    ObjNative* native = ALLOCATE_OBJ(ObjNative, OBJ_NATIVE);
+    native->function = function;
+    native->arity    = arity;
+    native->name     = name;
+    return native;
+}
 
-    // Check if we've interned this string already.
-    if (interned != NULL) {
+/* String hashing.
+ *
+ * This used to be FNV-1a, which eats one byte per multiply. Now we
+ * chew through the key 8 bytes at a time, and keys of 64 bytes or
+ * more are folded into four 64-bit lanes a 32-byte "stripe" at a
+ * time (the same accumulate step as xxHash's XXH3). The stripe loop
+ * uses AVX2 or SSE2 when the compiler targets them; the scalar
+ * version does exactly the same arithmetic, so every build produces
+ * the same hash for the same key. */
+#define HASH_PRIME_1 0x9E3779B185EBCA87ull
+#define HASH_PRIME_2 0xC2B2AE3D27D4EB4Full
+#define HASH_STRIPE  32
+// Below this the lane fold costs more than the stripes save.
+#define HASH_STRIPE_MIN 64
+
+// Per-lane keys mixed into each stripe before multiplying.
+static const uint64_t stripeKeys[4] = {
+    0xbe4ba423396cfeb8ull, 0x1cad21f72c81017cull,
+    0xdb979083e96dd4deull, 0x1f67b3b7a4a44072ull,
+};
+
+static inline uint64_t read64(const char* p) {
+    uint64_t word;
+    memcpy(&word, p, sizeof(word)); // Unaligned-safe load.
+    return word;
+}
+
+static inline uint64_t rotl64(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+// Final avalanche so every input bit affects every output bit.
+static inline uint64_t fmix64(uint64_t h) {
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdull;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ull;
+    h ^= h >> 33;
+    return h;
+}
+
+static inline uint64_t hashStep(uint64_t h, uint64_t word) {
+    return rotl64(h ^ (word * HASH_PRIME_2), 31) * HASH_PRIME_1;
+}
+
+/* Accumulate `stripes` 32-byte stripes of `key` into `acc`.
+ *
+ * For each 64-bit lane: mix the data with the lane key, multiply the
+ * low and high halves together and add in the neighbouring lane's
+ * raw data. */
+#if defined(__AVX2__)
+#include <immintrin.h>
+
+static void accumulate(uint64_t acc[4], const char* key, int stripes) {
+    __m256i a = _mm256_loadu_si256((const __m256i*)acc);
+    const __m256i k = _mm256_loadu_si256((const __m256i*)stripeKeys);
+
+    for (int i = 0; i < stripes; ++i) {
+        __m256i data = _mm256_loadu_si256(
+            (const __m256i*)(key + i * HASH_STRIPE));
+        __m256i dataKey = _mm256_xor_si256(data, k);
+        __m256i dataKeyHi = _mm256_shuffle_epi32(dataKey, 0x31);
+        __m256i product = _mm256_mul_epu32(dataKey, dataKeyHi);
+        __m256i swapped = _mm256_shuffle_epi32(data, 0x4E);
+        a = _mm256_add_epi64(a, _mm256_add_epi64(product, swapped));
+    }
+    _mm256_storeu_si256((__m256i*)acc, a);
+}
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+
+static void accumulate(uint64_t acc[4], const char* key, int stripes) {
+    __m128i a0 = _mm_loadu_si128((const __m128i*)acc);
+    __m128i a1 = _mm_loadu_si128((const __m128i*)(acc + 2));
+    const __m128i k0 = _mm_loadu_si128((const __m128i*)stripeKeys);
+    const __m128i k1 = _mm_loadu_si128((const __m128i*)(stripeKeys + 2));
+
+    for (int i = 0; i < stripes; ++i) {
+        const char* p = key + i * HASH_STRIPE;
+        __m128i d0 = _mm_loadu_si128((const __m128i*)p);
+        __m128i d1 = _mm_loadu_si128((const __m128i*)(p + 16));
+        __m128i dk0 = _mm_xor_si128(d0, k0);
+        __m128i dk1 = _mm_xor_si128(d1, k1);
+        __m128i p0 = _mm_mul_epu32(dk0, _mm_shuffle_epi32(dk0, 0x31));
+        __m128i p1 = _mm_mul_epu32(dk1, _mm_shuffle_epi32(dk1, 0x31));
+        a0 = _mm_add_epi64(a0, _mm_add_epi64(p0,
+                                   _mm_shuffle_epi32(d0, 0x4E)));
+        a1 = _mm_add_epi64(a1, _mm_add_epi64(p1,
+                                   _mm_shuffle_epi32(d1, 0x4E)));
+    }
+    _mm_storeu_si128((__m128i*)acc, a0);
+    _mm_storeu_si128((__m128i*)(acc + 2), a1);
+}
+#else
+static void accumulate(uint64_t acc[4], const char* key, int stripes) {
+    for (int i = 0; i < stripes; ++i) {
+        const char* p = key + i * HASH_STRIPE;
+        for (int lane = 0; lane < 4; ++lane) {
+            uint64_t data    = read64(p + lane * 8);
+            uint64_t dataKey = data ^ stripeKeys[lane];
+            uint64_t product = (dataKey & 0xffffffffull) *
+                               (dataKey >> 32);
+            // Lanes 0<->1 and 2<->3 swap their raw data.
+            acc[lane] += product + read64(p + (lane ^ 1) * 8);
+        }
+    }
+}
+#endif
+
+uint32_t hashString(const char* key, int length) {
+    uint64_t hash = HASH_PRIME_1 ^ ((uint64_t)length * HASH_PRIME_2);
+    int i = 0;
+
+    if (length >= HASH_STRIPE_MIN) {
+        uint64_t acc[4] = {
+            HASH_PRIME_1, HASH_PRIME_2, ~HASH_PRIME_1, ~HASH_PRIME_2,
+        };
+        int stripes = length / HASH_STRIPE;
+        accumulate(acc, key, stripes);
+        i = stripes * HASH_STRIPE;
+
+        for (int lane = 0; lane < 4; ++lane) {
+            hash = hashStep(hash, fmix64(acc[lane]));
+        }
+    }
+
+    // Whole words left over after the stripes (or a short key).
+    for (; i + 8 <= length; i += 8) {
+        hash = hashStep(hash, read64(key + i));
+    }
+
+    // 0-7 trailing bytes, zero-padded into one last word.
+    if (i < length) {
+        uint64_t tail = 0;
+        memcpy(&tail, key + i, length - i);
+        hash = hashStep(hash, tail);
+    }
+
+    return (uint32_t)fmix64(hash);
+}
+
+_Thread_local uint64_t stringLookups   = 0;
+_Thread_local uint64_t stringLocalHits = 0;
+
+/* Intern a heap string, taking ownership of `chars`.
+ *
+ * If the string has been interned already `chars` is freed and the
+ * existing string returned. Strings the VM already holds are found in
+ * vm.strings without going to the shared table; others are added
+ * there along with the reference internTake gives the VM. */
+ObjString* takeString(char* chars, int length) {
+    uint32_t   hash   = hashString(chars, length);
+    ObjString* string = tableFindString(&vm.strings, chars, length, hash);
+    stringLookups++;
+    if (string != NULL) {
+        stringLocalHits++;
         FREE_ARRAY(char, chars, length + 1);
-        return interned;
+        return string;
     }
-    return allocateString(chars, length, hash);
+
+    string = internTake(chars, length, hash);
+    tableSet(&vm.strings, string, NIL_VAL);
+    return string;
 }
 
+/* Intern a copy of `chars`, which needn't be null-terminated. */
 ObjString* copyString(const char* chars, int length) {
-    uint32_t hash = hashString(chars, length);
-    ObjString* interned = tableFindString(&vm.strings, chars, length,
-                                          hash);
-    // Check if we've interned this string in our strings map.
-    // If so, return a pointer to that string.
-    if (interned != NULL) return interned;
+    uint32_t   hash   = hashString(chars, length);
+    ObjString* string = tableFindString(&vm.strings, chars, length, hash);
+    stringLookups++;
+    if (string != NULL) {
+        stringLocalHits++;
+        return string;
+    }
 
-    char* heapChars = ALLOCATE(char, length +1);
-    memcpy(heapChars, chars, length);
-    heapChars[length] = '\0'; // Null terminate the string!
-    
-    return allocateString(heapChars, length, hash);
+    string = internCopy(chars, length, hash);
+    tableSet(&vm.strings, string, NIL_VAL);
+    return string;
+}
+
+static void printFunction(ObjFunction* function) {
+    if (function->name == NULL) {
+        printf("<script>");
+        return;
+    }
+    printf("<fn %s>", function->name->chars);
 }
 
 void printObject(Value value) {
     switch (OBJ_TYPE(value)) {
+        case OBJ_CLASS:
+            printf("%s", AS_CLASS(value)->name->chars);
+            break;
+        case OBJ_FUNCTION:
+            printFunction(AS_FUNCTION(value));
+            break;
+        case OBJ_INSTANCE:
+            printf("%s instance", AS_INSTANCE(value)->klass->name->chars);
+            break;
+        case OBJ_SHAPE:
+            printf("<shape>");
+            break;
+        case OBJ_NATIVE:
+            printf("<native fn %s>", AS_NATIVE(value)->name->chars);
+            break;
         case OBJ_STRING:
             printf("%s", AS_CSTRING(value));
             break;    
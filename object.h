@@ -2,18 +2,33 @@
 #define clox_object_h
 
 #include "common.h"
+#include "chunk.h"
+#include "table.h"
 #include "value.h"
 
 // Get the `type` field of a given object value.
 #define OBJ_TYPE(value)     (AS_OBJ(value)->type)
 
+#define IS_CLASS(value)     isObjType(value, OBJ_CLASS)
+#define IS_FUNCTION(value)  isObjType(value, OBJ_FUNCTION)
+#define IS_INSTANCE(value)  isObjType(value, OBJ_INSTANCE)
+#define IS_NATIVE(value)    isObjType(value, OBJ_NATIVE)
 #define IS_STRING(value)    isObjType(value, OBJ_STRING)
 
+#define AS_CLASS(value)     ((ObjClass*)AS_OBJ(value))
+#define AS_FUNCTION(value)  ((ObjFunction*)AS_OBJ(value))
+#define AS_INSTANCE(value)  ((ObjInstance*)AS_OBJ(value))
+#define AS_NATIVE(value)    ((ObjNative*)AS_OBJ(value))
 #define AS_STRING(value)    ((ObjString*)AS_OBJ(value))
 #define AS_CSTRING(value)   (((ObjString*)AS_OBJ(value))->chars)
 
 
 typedef enum {
+    OBJ_CLASS,
+    OBJ_FUNCTION,
+    OBJ_INSTANCE,
+    OBJ_NATIVE,
+    OBJ_SHAPE,
     OBJ_STRING,
 } ObjType;
 
@@ -30,8 +45,73 @@ struct ObjString {
     uint32_t hash;
 };
 
+typedef struct {
+    Obj        obj;
+    int        arity;
+    Chunk      chunk;
+    ObjString* name; // NULL for the top-level script.
+} ObjFunction;
+
+/* A function implemented in C.
+ *
+ * `args` points straight at the arguments on the VM stack, so calling
+ * a native copies nothing. It is only valid for the duration of the
+ * call. */
+typedef Value (*NativeFn)(int argCount, Value* args);
+
+typedef struct {
+    Obj        obj;
+    int        arity;
+    NativeFn   function;
+    ObjString* name;
+} ObjNative;
+
+/* The layout of an instance's fields, shared by every instance that
+ * had the same fields added in the same order.
+ *
+ * A shape is its parent plus one more field, `key`, which lives in
+ * slot `slotCount - 1`. Adding a field to an instance moves it along
+ * a transition to a child shape, which is created the first time and
+ * reused after that. So instances built the same way end up with the
+ * very same shape, and a field's slot can be cached per shape. */
+typedef struct Shape {
+    Obj           obj;
+    struct Shape* parent;    // NULL for a class's empty root shape.
+    ObjString*    key;
+    int           slotCount;
+    Table         transitions; // Field name -> child shape.
+} Shape;
+
+typedef struct {
+    Obj        obj;
+    ObjString* name;
+    Shape*     rootShape; // Where every new instance starts.
+} ObjClass;
+
+/* Fields are stored densely, in the order their shape gives. */
+typedef struct {
+    Obj       obj;
+    ObjClass* klass;
+    Shape*    shape;
+    Value*    fields;
+    int       fieldCapacity;
+} ObjInstance;
+
+ObjClass* newClass(ObjString* name);
+ObjFunction* newFunction();
+ObjInstance* newInstance(ObjClass* klass);
+int shapeFind(Shape* shape, ObjString* key);
+Shape* shapeAdd(Shape* shape, ObjString* key);
+void instanceSetShape(ObjInstance* instance, Shape* shape);
+ObjNative* newNative(NativeFn function, int arity, ObjString* name);
+uint32_t hashString(const char* key, int length);
 ObjString* takeString(char* chars, int length);
 ObjString* copyString(const char* chars, int length);
+
+// Strings looked up by takeString and copyString on this thread, and
+// how many of those vm.strings answered without the intern table.
+extern _Thread_local uint64_t stringLookups;
+extern _Thread_local uint64_t stringLocalHits;
 void printObject(Value value);
 
 static inline bool isObjType(Value value, ObjType type) {
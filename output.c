@@ -0,0 +1,127 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "memory.h"
+#include "number.h"
+#include "object.h"
+#include "output.h"
+
+void initOutput(Output* output) {
+    output->file            = stdout;
+    output->buffer          = NULL;
+    output->count           = 0;
+    output->capacity        = 0;
+    output->lineBuffered    = false;
+    output->shortestNumbers = false;
+    setOutputCapacity(output, OUTPUT_DEFAULT_CAPACITY);
+}
+
+void freeOutput(Output* output) {
+    flushOutput(output);
+    FREE_ARRAY(char, output->buffer, output->capacity);
+    output->buffer   = NULL;
+    output->capacity = 0;
+}
+
+/* Resize the buffer, flushing whatever is in it first. Anything
+ * smaller than a formatted number is rounded up to that. */
+void setOutputCapacity(Output* output, int capacity) {
+    if (capacity < NUMBER_BUFFER_SIZE) capacity = NUMBER_BUFFER_SIZE;
+
+    flushOutput(output);
+    output->buffer   = GROW_ARRAY(char, output->buffer,
+                                  output->capacity, capacity);
+    output->capacity = capacity;
+}
+
+void flushOutput(Output* output) {
+    if (output->count == 0) return;
+
+    fwrite(output->buffer, 1, output->count, output->file);
+    fflush(output->file);
+    output->count = 0;
+}
+
+/* Make room for `length` more bytes, if the buffer can hold them. */
+static inline void reserve(Output* output, int length) {
+    if (output->count + length > output->capacity) flushOutput(output);
+}
+
+void writeOutput(Output* output, const char* chars, int length) {
+    reserve(output, length);
+
+    // Too big to buffer at all: write it straight through.
+    if (length > output->capacity) {
+        fwrite(chars, 1, length, output->file);
+        return;
+    }
+
+    memcpy(output->buffer + output->count, chars, length);
+    output->count += length;
+}
+
+/* What OP_PRINT does: the value, then a newline. */
+void printValueLine(Output* output, Value value) {
+    switch (value.type) {
+        case VAL_BOOL:
+            if (AS_BOOL(value)) {
+                writeOutput(output, "true", 4);
+            } else {
+                writeOutput(output, "false", 5);
+            }
+            break;
+        case VAL_NIL:
+            writeOutput(output, "nil", 3);
+            break;
+        case VAL_NUMBER:
+            reserve(output, NUMBER_BUFFER_SIZE);
+            output->count += formatNumber(AS_NUMBER(value),
+                                          output->buffer + output->count,
+                                          output->shortestNumbers);
+            break;
+        case VAL_OBJ:
+            switch (OBJ_TYPE(value)) {
+                case OBJ_CLASS: {
+                    ObjString* name = AS_CLASS(value)->name;
+                    writeOutput(output, name->chars, name->length);
+                    break;
+                }
+                case OBJ_INSTANCE: {
+                    ObjString* name = AS_INSTANCE(value)->klass->name;
+                    writeOutput(output, name->chars, name->length);
+                    writeOutput(output, " instance", 9);
+                    break;
+                }
+                case OBJ_SHAPE:
+                    writeOutput(output, "<shape>", 7);
+                    break;
+                case OBJ_FUNCTION: {
+                    ObjString* name = AS_FUNCTION(value)->name;
+                    if (name == NULL) {
+                        writeOutput(output, "<script>", 8);
+                        break;
+                    }
+                    writeOutput(output, "<fn ", 4);
+                    writeOutput(output, name->chars, name->length);
+                    writeOutput(output, ">", 1);
+                    break;
+                }
+                case OBJ_NATIVE: {
+                    ObjString* name = AS_NATIVE(value)->name;
+                    writeOutput(output, "<native fn ", 11);
+                    writeOutput(output, name->chars, name->length);
+                    writeOutput(output, ">", 1);
+                    break;
+                }
+                case OBJ_STRING: {
+                    ObjString* string = AS_STRING(value);
+                    writeOutput(output, string->chars, string->length);
+                    break;
+                }
+            }
+            break;
+    }
+
+    writeOutput(output, "\n", 1);
+    if (output->lineBuffered) flushOutput(output);
+}
@@ -0,0 +1,32 @@
+#ifndef clox_output_h
+#define clox_output_h
+
+#include "common.h"
+#include "value.h"
+
+#define OUTPUT_DEFAULT_CAPACITY (64 * 1024)
+
+#include <stdio.h>
+
+/* Buffered output for `print`, to stdout unless `file` says otherwise.
+ *
+ * Printed values are formatted straight into `buffer`, which is
+ * written out in one go when it fills up, when the VM finishes a
+ * script and (if `lineBuffered` is set) after every line. */
+typedef struct {
+    FILE* file;
+    char* buffer;
+    int   count;
+    int   capacity;
+    bool  lineBuffered;
+    bool  shortestNumbers; // Shortest round-trip numbers, not %g.
+} Output;
+
+void initOutput(Output* output);
+void freeOutput(Output* output);
+void setOutputCapacity(Output* output, int capacity);
+void flushOutput(Output* output);
+void writeOutput(Output* output, const char* chars, int length);
+void printValueLine(Output* output, Value value);
+
+#endif
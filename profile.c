@@ -0,0 +1,290 @@
+#define _GNU_SOURCE // For gettid().
+
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "intern.h"
+#include "profile.h"
+#include "vm.h"
+
+#define PROFILE_MAX_SAMPLES (1 << 18)
+#define PROFILE_MAX_FRAMES  (1 << 21)
+#define PROFILE_HOT_LINES   20
+
+/* One frame of a sampled stack. Function names are interned, and each
+ * frame holds a reference to its name, so it outlives the VM that ran
+ * the function. */
+typedef struct {
+    ObjString* name; // NULL for the top-level script.
+    int        line;
+} ProfileFrame;
+
+typedef struct {
+    int start; // Into `frames`, outermost frame first.
+    int depth; // Zero if nothing was running (e.g. compiling).
+} Sample;
+
+static const char*   profilePath = NULL;
+static bool          profiling   = false;
+static timer_t       timer;
+static Sample*       samples     = NULL;
+static ProfileFrame* frames      = NULL;
+
+// Samples and frames recorded so far, packed into one word (samples in
+// the top half) so that a sample claims its slots in both buffers
+// with one compare-and-swap.
+static _Atomic uint64_t claimed      = 0;
+static _Atomic int      droppedCount = 0;
+
+// Unpacked from `claimed` once sampling has stopped.
+static int sampleCount = 0;
+static int frameCount  = 0;
+
+/* SIGPROF handler. vm.ip can lag a few instructions behind, since
+ * run() is free to keep it in a register, so a sample can land on a
+ * neighbouring line of the same function. */
+static void takeSample(int signal) {
+    (void)signal;
+
+    // Read the stack into a copy first, so that nothing is claimed
+    // for a sample that gets dropped.
+    ProfileFrame stack[FRAMES_MAX];
+    int          depth = vm.frameCount;
+    for (int i = 0; i < depth; i++) {
+        CallFrame*   frame    = &vm.frames[i];
+        ObjFunction* function = frame->function;
+        uint8_t*     ip       = i == depth - 1 ? vm.ip : frame->ip;
+
+        // Caught in the middle of a call or return.
+        if (function == NULL || ip <= function->chunk.code ||
+                ip > function->chunk.code + function->chunk.count) {
+            atomic_fetch_add_explicit(&droppedCount, 1,
+                                      memory_order_relaxed);
+            return;
+        }
+
+        int offset = (int)(ip - function->chunk.code) - 1;
+        stack[i].name = function->name;
+        stack[i].line = function->chunk.lines[offset];
+    }
+
+    uint64_t counts = atomic_load_explicit(&claimed, memory_order_relaxed);
+    uint64_t wanted;
+    do {
+        if ((int)(counts >> 32) == PROFILE_MAX_SAMPLES ||
+                (int)(uint32_t)counts + depth > PROFILE_MAX_FRAMES) {
+            atomic_fetch_add_explicit(&droppedCount, 1,
+                                      memory_order_relaxed);
+            return;
+        }
+        wanted = counts + ((uint64_t)1 << 32) + (uint64_t)depth;
+    } while (!atomic_compare_exchange_weak_explicit(
+                 &claimed, &counts, wanted,
+                 memory_order_relaxed, memory_order_relaxed));
+
+    // Retained only now the sample is sure to be kept, so that
+    // finishProfile has exactly one reference to give back per name.
+    Sample* sample = &samples[counts >> 32];
+    sample->start = (int)(uint32_t)counts;
+    sample->depth = depth;
+    for (int i = 0; i < depth; i++) {
+        if (stack[i].name != NULL) internRetain(stack[i].name);
+        frames[sample->start + i] = stack[i];
+    }
+}
+
+/* Start sampling the calling thread `hz` times per second of its CPU
+ * time, writing the collapsed stacks to `path` when finishProfile() is
+ * called or at exit. */
+void startProfile(const char* path, int hz) {
+    samples = malloc(sizeof(Sample) * PROFILE_MAX_SAMPLES);
+    frames  = malloc(sizeof(ProfileFrame) * PROFILE_MAX_FRAMES);
+    if (samples == NULL || frames == NULL) {
+        fprintf(stderr, "Not enough memory to profile.\n");
+        exit(74);
+    }
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = takeSample;
+    action.sa_flags   = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGPROF, &action, NULL);
+
+    // Timed by, and delivered to, this thread alone: vm is per
+    // thread, and any other thread's may not be one that runs scripts.
+    struct sigevent event;
+    memset(&event, 0, sizeof(event));
+    event.sigev_notify   = SIGEV_THREAD_ID;
+    event.sigev_signo    = SIGPROF;
+    event._sigev_un._tid = gettid();
+    if (timer_create(CLOCK_THREAD_CPUTIME_ID, &event, &timer) != 0) {
+        perror("timer_create");
+        exit(71);
+    }
+
+    long interval = 1000000000L / hz;
+    if (interval < 1) interval = 1;
+    struct itimerspec spec;
+    spec.it_interval.tv_sec  = interval / 1000000000L;
+    spec.it_interval.tv_nsec = interval % 1000000000L;
+    spec.it_value            = spec.it_interval;
+    timer_settime(timer, 0, &spec, NULL);
+
+    profilePath = path;
+    profiling   = true;
+    atexit(finishProfile);
+}
+
+static const char* frameName(ProfileFrame* frame) {
+    return frame->name == NULL ? "script" : frame->name->chars;
+}
+
+typedef struct {
+    ProfileFrame frame;
+    int          self;  // Samples with this line on top.
+    int          total; // Samples with it anywhere on the stack.
+} LineCount;
+
+static int compareSelf(const void* a, const void* b) {
+    const LineCount* lineA = a;
+    const LineCount* lineB = b;
+    if (lineA->self != lineB->self) return lineB->self - lineA->self;
+    return lineB->total - lineA->total;
+}
+
+static LineCount* findLine(LineCount* lines, int* count,
+                           ProfileFrame* frame) {
+    for (int i = 0; i < *count; i++) {
+        if (lines[i].frame.name == frame->name &&
+                lines[i].frame.line == frame->line) {
+            return &lines[i];
+        }
+    }
+    LineCount* line = &lines[(*count)++];
+    line->frame = *frame;
+    line->self  = 0;
+    line->total = 0;
+    return line;
+}
+
+static void printHotLines() {
+    // A line per distinct frame at most; scripts have few enough of
+    // them that a linear search will do.
+    LineCount* lines = malloc(sizeof(LineCount) * (frameCount + 1));
+    int        count = 0;
+    int        idle  = 0;
+
+    for (int s = 0; s < sampleCount; s++) {
+        Sample* sample = &samples[s];
+        if (sample->depth == 0) {
+            idle++;
+            continue;
+        }
+
+        for (int i = 0; i < sample->depth; i++) {
+            ProfileFrame* frame = &frames[sample->start + i];
+            LineCount*    line  = findLine(lines, &count, frame);
+
+            // Count a line once per sample, however deep the recursion.
+            bool seen = false;
+            for (int j = 0; j < i; j++) {
+                ProfileFrame* other = &frames[sample->start + j];
+                if (other->name == frame->name &&
+                        other->line == frame->line) {
+                    seen = true;
+                    break;
+                }
+            }
+            if (!seen) line->total++;
+            if (i == sample->depth - 1) line->self++;
+        }
+    }
+    qsort(lines, count, sizeof(LineCount), compareSelf);
+
+    fprintf(stderr, "== profile: %d samples, %d dropped, "
+                    "%d outside run() ==\n",
+            sampleCount, atomic_load(&droppedCount), idle);
+    fprintf(stderr, "%7s %7s %8s %6s  %s\n",
+            "self%", "total%", "samples", "line", "function");
+    double percent = sampleCount > 0 ? 100.0 / sampleCount : 0;
+    for (int i = 0; i < count && i < PROFILE_HOT_LINES; i++) {
+        fprintf(stderr, "%6.1f%% %6.1f%% %8d %6d  %s\n",
+                lines[i].self * percent, lines[i].total * percent,
+                lines[i].self, lines[i].frame.line,
+                frameName(&lines[i].frame));
+    }
+    free(lines);
+}
+
+static int compareStrings(const void* a, const void* b) {
+    return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+/* "script:3;fib:1;fib:1" for each sample, sorted so identical stacks
+ * are next to each other, then written once each with their count. */
+static void writeCollapsed() {
+    FILE* file = fopen(profilePath, "w");
+    if (file == NULL) {
+        perror(profilePath);
+        return;
+    }
+
+    char** stacks = malloc(sizeof(char*) * (sampleCount + 1));
+    for (int s = 0; s < sampleCount; s++) {
+        Sample* sample = &samples[s];
+        size_t  length = 0;
+        char*   stack  = NULL;
+        FILE*   out    = open_memstream(&stack, &length);
+        if (sample->depth == 0) fputs("(outside run)", out);
+        for (int i = 0; i < sample->depth; i++) {
+            ProfileFrame* frame = &frames[sample->start + i];
+            fprintf(out, "%s%s:%d", i == 0 ? "" : ";",
+                    frameName(frame), frame->line);
+        }
+        fclose(out);
+        stacks[s] = stack;
+    }
+    qsort(stacks, sampleCount, sizeof(char*), compareStrings);
+
+    for (int s = 0; s < sampleCount;) {
+        int next = s + 1;
+        while (next < sampleCount && strcmp(stacks[next], stacks[s]) == 0) {
+            next++;
+        }
+        fprintf(file, "%s %d\n", stacks[s], next - s);
+        s = next;
+    }
+    fclose(file);
+
+    for (int s = 0; s < sampleCount; s++) free(stacks[s]);
+    free(stacks);
+}
+
+/* Stop sampling and write the reports. Safe to call more than once;
+ * main() calls it before the intern table is freed. */
+void finishProfile() {
+    if (!profiling) return;
+    profiling = false;
+
+    timer_delete(timer);
+    signal(SIGPROF, SIG_IGN);
+
+    uint64_t counts = atomic_load_explicit(&claimed, memory_order_relaxed);
+    sampleCount = (int)(counts >> 32);
+    frameCount  = (int)(uint32_t)counts;
+
+    printHotLines();
+    writeCollapsed();
+
+    for (int i = 0; i < frameCount; i++) {
+        if (frames[i].name != NULL) internRelease(frames[i].name);
+    }
+    free(samples);
+    free(frames);
+}
@@ -0,0 +1,25 @@
+#ifndef clox_profile_h
+#define clox_profile_h
+
+#include "common.h"
+
+/* A sampling profiler (--sample-profile).
+ *
+ * A SIGPROF timer interrupts the interpreter `hz` times per second of
+ * CPU time. Only the thread that starts the profiler is timed and
+ * sampled: with --serve-threads, that is the first of the serving VMs.
+ * Each sample records the call stack as it is, as function
+ * name and source line per frame, read from the frames, vm.ip and
+ * Chunk.lines. At the end the samples become a list of the hottest
+ * lines, on stderr, and a file of collapsed stacks ("script:3;fib:1
+ * 42" lines) for flamegraph.pl and similar tools.
+ *
+ * Samples go into buffers allocated up front, so taking one costs a
+ * signal and a walk of the frames. Once the buffers are full, further
+ * samples are counted as dropped. */
+#define PROFILE_DEFAULT_HZ 1000
+
+void startProfile(const char* path, int hz);
+void finishProfile();
+
+#endif
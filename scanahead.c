@@ -0,0 +1,143 @@
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "scanahead.h"
+
+// Each side publishes its position only every this many tokens, so
+// the two threads aren't passing a cache line back and forth on every
+// token. Either side publishes straight away before it waits.
+#define SCAN_AHEAD_BATCH 64
+
+typedef struct {
+    // Tokens scanned so far. Written by the scanner thread.
+    _Alignas(64) atomic_size_t tail;
+    // Tokens read so far. Written by the compiler.
+    _Alignas(64) atomic_size_t head;
+    atomic_bool  stop; // Set to make the scanner thread give up.
+
+    // The compiler's side.
+    _Alignas(64) size_t readHead;
+    size_t knownTail;
+    bool   sawEof;
+    Token  eof;
+
+    const char* source;
+    pthread_t   thread;
+
+    _Alignas(64) Token tokens[SCAN_AHEAD_TOKENS];
+} TokenRing;
+
+// The ring of the compile running on this thread, if it's using one.
+static _Thread_local TokenRing* ring = NULL;
+
+/* Wait for the other side: spin briefly, then give up the CPU. */
+static void waitABit(int* spins) {
+    if (++*spins < 64) {
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#endif
+        return;
+    }
+    sched_yield();
+}
+
+static void* scanLoop(void* argument) {
+    TokenRing* tokens = argument;
+    initScanner(tokens->source);
+
+    size_t tail      = 0;
+    size_t knownHead = 0;
+    for (;;) {
+        Token token = scanToken();
+
+        if (tail - knownHead == SCAN_AHEAD_TOKENS) {
+            atomic_store_explicit(&tokens->tail, tail, memory_order_release);
+            int spins = 0;
+            for (;;) {
+                knownHead = atomic_load_explicit(&tokens->head,
+                                                 memory_order_acquire);
+                if (tail - knownHead < SCAN_AHEAD_TOKENS) break;
+                if (atomic_load_explicit(&tokens->stop,
+                                         memory_order_relaxed)) {
+                    return NULL;
+                }
+                waitABit(&spins);
+            }
+        }
+
+        tokens->tokens[tail % SCAN_AHEAD_TOKENS] = token;
+        tail++;
+        if (token.type == TOKEN_EOF || tail % SCAN_AHEAD_BATCH == 0) {
+            atomic_store_explicit(&tokens->tail, tail, memory_order_release);
+        }
+        if (token.type == TOKEN_EOF) return NULL;
+    }
+}
+
+/* Start scanning `source` on a new thread. Falls back to scanning as
+ * the tokens are asked for if the thread can't be started. */
+void startScanAhead(const char* source) {
+    TokenRing* tokens = aligned_alloc(64, sizeof(TokenRing));
+    if (tokens == NULL) {
+        fprintf(stderr, "Not enough memory to scan ahead.\n");
+        exit(74);
+    }
+    atomic_init(&tokens->tail, 0);
+    atomic_init(&tokens->head, 0);
+    atomic_init(&tokens->stop, false);
+    tokens->readHead  = 0;
+    tokens->knownTail = 0;
+    tokens->sawEof    = false;
+    tokens->source    = source;
+
+    if (pthread_create(&tokens->thread, NULL, scanLoop, tokens) != 0) {
+        free(tokens);
+        initScanner(source);
+        ring = NULL;
+        return;
+    }
+    ring = tokens;
+}
+
+Token nextScannedToken() {
+    if (ring == NULL) return scanToken();
+    if (ring->sawEof) return ring->eof;
+
+    if (ring->readHead == ring->knownTail) {
+        atomic_store_explicit(&ring->head, ring->readHead,
+                              memory_order_release);
+        int spins = 0;
+        for (;;) {
+            ring->knownTail = atomic_load_explicit(&ring->tail,
+                                                   memory_order_acquire);
+            if (ring->knownTail != ring->readHead) break;
+            waitABit(&spins);
+        }
+    }
+
+    Token token = ring->tokens[ring->readHead % SCAN_AHEAD_TOKENS];
+    ring->readHead++;
+    if (ring->readHead % SCAN_AHEAD_BATCH == 0) {
+        atomic_store_explicit(&ring->head, ring->readHead,
+                              memory_order_release);
+    }
+
+    if (token.type == TOKEN_EOF) {
+        ring->sawEof = true;
+        ring->eof    = token;
+    }
+    return token;
+}
+
+/* Stop the scanner thread, if it's still going, and free the ring. */
+void finishScanAhead() {
+    if (ring == NULL) return;
+
+    atomic_store_explicit(&ring->stop, true, memory_order_relaxed);
+    pthread_join(ring->thread, NULL);
+    free(ring);
+    ring = NULL;
+}
@@ -0,0 +1,22 @@
+#ifndef clox_scanahead_h
+#define clox_scanahead_h
+
+#include "common.h"
+#include "scanner.h"
+
+/* Scanning on a thread of its own, ahead of the parser
+ * (--pipeline-scanner).
+ *
+ * The scanner thread writes tokens into a single-producer,
+ * single-consumer ring which the compiler reads from in place of
+ * calling scanToken(), so scanning and code generation overlap.
+ * Tokens, error tokens included, arrive in the order they were
+ * scanned. Once the EOF token has been read it is returned again for
+ * every later call, as scanToken() would. */
+#define SCAN_AHEAD_TOKENS 4096
+
+void  startScanAhead(const char* source);
+Token nextScannedToken();
+void  finishScanAhead();
+
+#endif
@@ -3,6 +3,7 @@
 
 #include "common.h"
 #include "scanner.h"
+#include "keywords.h"
 
 typedef struct {
     const char* start;   // The start of the current lexeme
@@ -10,7 +11,7 @@ typedef struct {
     int         line;    // the line number, for error reporting.
 } Scanner;
 
-Scanner scanner;
+_Thread_local Scanner scanner;
 
 void initScanner(const char* source) {
     scanner.start   = source;
@@ -28,6 +29,137 @@ static bool isDigit(char c) {
     return (c >= '0' && c <='9');
 }
 
+/* Vectorised fast paths.
+ *
+ * Each of these runs from `p` to the first byte of interest, looking
+ * at 16 bytes at a time. Loads are 16-byte aligned: the first block
+ * starts before `p` (those bytes are masked off) and the last one may
+ * run past the source's terminating NUL, but an aligned load can't
+ * cross into another page, so that's never an invalid read. The NUL
+ * itself always counts as a byte of interest, so no scan runs off the
+ * end of the source. */
+#if defined(__SSE2__)
+#include <emmintrin.h>
+
+#define BLOCK 16
+
+#if defined(__has_feature)
+#if __has_feature(address_sanitizer)
+#define NO_ASAN __attribute__((no_sanitize_address))
+#endif
+#elif defined(__SANITIZE_ADDRESS__)
+#define NO_ASAN __attribute__((no_sanitize_address))
+#endif
+#ifndef NO_ASAN
+#define NO_ASAN
+#endif
+
+static inline __m128i loadBlock(const char* block) {
+    return _mm_load_si128((const __m128i*)block);
+}
+
+static inline uint32_t maskOf(__m128i bytes) {
+    return (uint32_t)_mm_movemask_epi8(bytes);
+}
+
+static inline __m128i eq(__m128i bytes, char c) {
+    return _mm_cmpeq_epi8(bytes, _mm_set1_epi8(c));
+}
+
+// Bytes in [lo, hi], using signed compares. Only used for ASCII
+// ranges, so bytes >= 0x80 (negative) never match.
+static inline __m128i inRange(__m128i bytes, char lo, char hi) {
+    return _mm_and_si128(_mm_cmpgt_epi8(bytes, _mm_set1_epi8(lo - 1)),
+                         _mm_cmplt_epi8(bytes, _mm_set1_epi8(hi + 1)));
+}
+
+/* Stop at anything that isn't ' ', '\r', '\t' or '\n'. */
+static inline uint32_t stopAtNonSpace(__m128i b, uint32_t* newlines) {
+    __m128i newline = eq(b, '\n');
+    __m128i space = _mm_or_si128(
+        _mm_or_si128(eq(b, ' '), eq(b, '\t')),
+        _mm_or_si128(eq(b, '\r'), newline));
+    *newlines = maskOf(newline);
+    return ~maskOf(space) & 0xFFFF;
+}
+
+/* Stop at the newline (or NUL) ending a comment. */
+static inline uint32_t stopAtLineEnd(__m128i b, uint32_t* newlines) {
+    *newlines = 0;
+    return maskOf(_mm_or_si128(eq(b, '\n'), eq(b, '\0')));
+}
+
+/* Stop at the closing quote (or NUL) of a string literal. */
+static inline uint32_t stopAtQuote(__m128i b, uint32_t* newlines) {
+    *newlines = maskOf(eq(b, '\n'));
+    return maskOf(_mm_or_si128(eq(b, '"'), eq(b, '\0')));
+}
+
+/* Stop at anything that can't continue an identifier. Setting 0x20
+ * folds upper case onto lower case without creating new letters. */
+static inline uint32_t stopAtNonIdent(__m128i b, uint32_t* newlines) {
+    __m128i lower = _mm_or_si128(b, _mm_set1_epi8(0x20));
+    __m128i ident = _mm_or_si128(
+        _mm_or_si128(inRange(lower, 'a', 'z'), inRange(b, '0', '9')),
+        eq(b, '_'));
+    *newlines = 0;
+    return ~maskOf(ident) & 0xFFFF;
+}
+
+/* Run `stop` over the blocks from `p`, returning the first byte it
+ * stops at and adding the newlines skipped over to `*lines`. */
+#define SCAN_BLOCKS(name, stop)                                     \
+    static NO_ASAN const char* name(const char* p, int* lines) {    \
+        uintptr_t skip  = (uintptr_t)p & (BLOCK - 1);               \
+        const char* block = p - skip;                               \
+        uint32_t newlines;                                          \
+        uint32_t live = 0xFFFFu << skip;                            \
+        uint32_t mask = stop(loadBlock(block), &newlines) & live;   \
+        while (mask == 0) {                                         \
+            *lines += __builtin_popcount(newlines & live);          \
+            block += BLOCK;                                         \
+            live   = 0xFFFF;                                        \
+            mask   = stop(loadBlock(block), &newlines);             \
+        }                                                           \
+        uint32_t before = (mask & -mask) - 1;                       \
+        *lines += __builtin_popcount(newlines & live & before);     \
+        return block + __builtin_ctz(mask);                         \
+    }
+
+SCAN_BLOCKS(skipSpaces,     stopAtNonSpace)
+SCAN_BLOCKS(skipComment,    stopAtLineEnd)
+SCAN_BLOCKS(skipStringBody, stopAtQuote)
+SCAN_BLOCKS(skipIdentifier, stopAtNonIdent)
+
+#undef SCAN_BLOCKS
+#else
+static const char* skipSpaces(const char* p, int* lines) {
+    for (;; p++) {
+        if (*p == '\n') (*lines)++;
+        else if (*p != ' ' && *p != '\r' && *p != '\t') return p;
+    }
+}
+
+static const char* skipComment(const char* p, int* lines) {
+    (void)lines;
+    while (*p != '\n' && *p != '\0') p++;
+    return p;
+}
+
+static const char* skipStringBody(const char* p, int* lines) {
+    for (; *p != '"' && *p != '\0'; p++) {
+        if (*p == '\n') (*lines)++;
+    }
+    return p;
+}
+
+static const char* skipIdentifier(const char* p, int* lines) {
+    (void)lines;
+    while (isAlpha(*p) || isDigit(*p)) p++;
+    return p;
+}
+#endif
+
 static bool isAtEnd() {
     return *scanner.current == '\0';
 }
@@ -87,16 +219,15 @@ static void skipWhitespace() {
             case ' ':
             case '\r':
             case '\t':
-                advance();
-                break;
             case '\n':
-                scanner.line++;
-                advance();
+                scanner.current = skipSpaces(scanner.current,
+                                             &scanner.line);
                 break;
             case '/':
                 if (peekNext() == '/') {
                     // A comment lasts until the end of the line.
-                    while (peek() != '\n' && !isAtEnd()) advance();
+                    scanner.current = skipComment(scanner.current,
+                                                  &scanner.line);
                 } else {
                     // Not a comment, no-op.
                     return;
@@ -108,58 +239,30 @@ static void skipWhitespace() {
     }
 }
 
-static TokenType checkKeyword(
-    int start, int length,
-    const char* rest, TokenType type
-) {
-    // First check the length, then the string value.
-    // Return the candidate type if a match is found.
-    if (scanner.current - scanner.start == start + length && 
-            memcmp(scanner.start + start, rest, length) == 0) {
-        return type;    
+/* Classify the current lexeme as a keyword or an identifier.
+ *
+ * keywords.h is a perfect hash on the first and last characters and
+ * the length, generated from keywords.def, so only one candidate
+ * keyword ever needs comparing. */
+static TokenType identifierType() {
+    int length = (int)(scanner.current - scanner.start);
+    if (length < KEYWORD_MIN_LENGTH || length > KEYWORD_MAX_LENGTH) {
+        return TOKEN_IDENTIFIER;
     }
 
-    return TOKEN_IDENTIFIER;
-}
-
-static TokenType identifierType() {
-    switch (scanner.start[0]) {
-        case 'a': return checkKeyword(1, 2, "nd", TOKEN_AND);
-        case 'c': return checkKeyword(1, 4, "lass", TOKEN_CLASS);
-        case 'e': return checkKeyword(1, 3, "lse", TOKEN_ELSE);
-        case 'f':
-            if (scanner.current - scanner.start > 1) {
-            switch (scanner.start[1]) {
-                case 'a':
-                    return checkKeyword(2, 3, "lse", TOKEN_FALSE);
-                case 'o':
-                    return checkKeyword(2, 1, "r", TOKEN_FOR);
-                case 'u':
-                    return checkKeyword(2, 1, "n", TOKEN_FUN);
-            }}
-            break;
-        case 'i': return checkKeyword(1, 1, "f", TOKEN_IF);
-        case 'n': return checkKeyword(1, 2, "il", TOKEN_NIL);
-        case 'o': return checkKeyword(1, 1, "r", TOKEN_OR);
-        case 'p': return checkKeyword(1, 4, "rint", TOKEN_PRINT);
-        case 'r': return checkKeyword(1, 5, "eturn", TOKEN_RETURN);
-        case 's': return checkKeyword(1, 4, "uper", TOKEN_SUPER);
-        case 't':
-            if (scanner.current - scanner.start > 1) {
-            switch (scanner.start[1]) {
-                case 'h':
-                    return checkKeyword(2, 2, "is", TOKEN_THIS);
-                case 'r':
-                    return checkKeyword(2, 2, "ue", TOKEN_TRUE);
-            }}
-            break;
-        case 'v': return checkKeyword(1, 2, "ar", TOKEN_VAR);
-        case 'w': return checkKeyword(1, 4, "hile", TOKEN_WHILE);
+    const Keyword* keyword = &keywords[KEYWORD_HASH(
+        (unsigned char)scanner.start[0],
+        (unsigned char)scanner.current[-1], length)];
+    if (keyword->length == length &&
+            memcmp(scanner.start, keyword->name, length) == 0) {
+        return keyword->type;
     }
+
     return TOKEN_IDENTIFIER;
 }
+
 static Token identifier() {
-    while (isAlpha(peek()) || isDigit(peek())) advance();
+    scanner.current = skipIdentifier(scanner.current, &scanner.line);
 
     return makeToken(identifierType());
 }
@@ -179,12 +282,8 @@ static Token number() {
 }
 
 static Token string(){
-    while (peek() != '"' && !isAtEnd()) {
-        // Allow multi-line strings
-        if (peek() == '\n') scanner.line++;
-        
-        advance();
-    }
+    // Allow multi-line strings
+    scanner.current = skipStringBody(scanner.current, &scanner.line);
 
     if (isAtEnd()) return errorToken("Unterminated string.");
 
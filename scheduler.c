@@ -0,0 +1,176 @@
+#include <stdatomic.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "compiler.h"
+#include "memory.h"
+#include "scheduler.h"
+
+static double nowMs(clockid_t clock) {
+    struct timespec now;
+    clock_gettime(clock, &now);
+    return (double)now.tv_sec * 1e3 + now.tv_nsec / 1e6;
+}
+
+/* Make `context` the thread's VM. The sampling profiler can interrupt
+ * at any point and walk vm.frames, so no frames are visible to it
+ * until the whole context has been copied in. */
+static void switchVM(VM* context) {
+    int frameCount = context->frameCount;
+    context->frameCount = 0;
+    vm.frameCount       = 0;
+    atomic_signal_fence(memory_order_seq_cst);
+
+    vm = *context;
+
+    atomic_signal_fence(memory_order_seq_cst);
+    vm.frameCount       = frameCount;
+    context->frameCount = frameCount;
+}
+
+void initScheduler(Scheduler* scheduler) {
+    scheduler->tasks             = NULL;
+    scheduler->count             = 0;
+    scheduler->capacity          = 0;
+    scheduler->sliceInstructions = SCHEDULER_DEFAULT_SLICE;
+    scheduler->timeoutMs         = 0;
+}
+
+/* Free the tasks, and the contexts of any that never finished. */
+void freeScheduler(Scheduler* scheduler) {
+    VM host = vm;
+    for (int i = 0; i < scheduler->count; i++) {
+        Task* task = &scheduler->tasks[i];
+        if (task->result != INTERPRET_YIELD) continue;
+        switchVM(&task->vm);
+        freeVM();
+    }
+    switchVM(&host);
+
+    FREE_ARRAY(Task, scheduler->tasks, scheduler->capacity);
+    initScheduler(scheduler);
+}
+
+/* Compile `source` into a new task with a fresh context, set up the
+ * same way as the thread's current VM. A compile error is reported
+ * right away and leaves a task that has already finished. Returns the
+ * task's index. */
+int spawnTask(Scheduler* scheduler, const char* name, const char* source) {
+    if (scheduler->count + 1 > scheduler->capacity) {
+        int oldCapacity = scheduler->capacity;
+        scheduler->capacity = GROW_CAPACITY(oldCapacity);
+        scheduler->tasks = GROW_ARRAY(Task, scheduler->tasks, oldCapacity,
+                                      scheduler->capacity);
+    }
+
+    Task* task = &scheduler->tasks[scheduler->count];
+    task->name         = name;
+    task->result       = INTERPRET_YIELD;
+    task->timedOut     = false;
+    task->instructions = 0;
+    task->cpuMs        = 0;
+    task->slices       = 0;
+    task->maxWaitMs    = 0;
+    task->lastRanAt    = 0;
+
+    VM host = vm;
+    initVM();
+    vm.globals.incremental     = host.globals.incremental;
+    vm.strings.incremental     = host.strings.incremental;
+    vm.output.lineBuffered     = host.output.lineBuffered;
+    vm.output.shortestNumbers  = host.output.shortestNumbers;
+    vm.reportHotLoops          = host.reportHotLoops;
+    vm.pipelineScanner         = host.pipelineScanner;
+    setOutputCapacity(&vm.output, host.output.capacity);
+
+    ObjFunction* function = compile(source);
+    if (function == NULL) {
+        task->result = INTERPRET_COMPILE_ERROR;
+        freeVM();
+    } else {
+        loadFunction(function);
+        task->vm = vm;
+    }
+    switchVM(&host);
+
+    return scheduler->count++;
+}
+
+/* Give `task` one turn on the thread. */
+static void runSlice(Scheduler* scheduler, Task* task) {
+    double started = nowMs(CLOCK_MONOTONIC);
+    double waited  = started - task->lastRanAt;
+    if (waited > task->maxWaitMs) task->maxWaitMs = waited;
+
+    switchVM(&task->vm);
+    vm.budget = scheduler->sliceInstructions;
+
+    double cpuStarted = nowMs(CLOCK_THREAD_CPUTIME_ID);
+    task->result = resumeVM();
+    task->cpuMs += nowMs(CLOCK_THREAD_CPUTIME_ID) - cpuStarted;
+    task->slices++;
+
+    if (task->result == INTERPRET_YIELD && scheduler->timeoutMs > 0 &&
+            task->cpuMs > scheduler->timeoutMs) {
+        flushOutput(&vm.output);
+        fprintf(vm.errors, "Script timed out after %.0f ms of CPU time.\n",
+                task->cpuMs);
+        task->result   = INTERPRET_RUNTIME_ERROR;
+        task->timedOut = true;
+    }
+
+    task->instructions = vm.instructionCount;
+    if (task->result == INTERPRET_YIELD) {
+        task->vm = vm;
+    } else {
+        freeVM();
+    }
+    task->lastRanAt = nowMs(CLOCK_MONOTONIC);
+}
+
+/* Run every task round-robin until all of them have finished. */
+void runScheduler(Scheduler* scheduler) {
+    VM host = vm;
+
+    int    running = 0;
+    double now     = nowMs(CLOCK_MONOTONIC);
+    for (int i = 0; i < scheduler->count; i++) {
+        scheduler->tasks[i].lastRanAt = now;
+        if (scheduler->tasks[i].result == INTERPRET_YIELD) running++;
+    }
+
+    while (running > 0) {
+        for (int i = 0; i < scheduler->count; i++) {
+            Task* task = &scheduler->tasks[i];
+            if (task->result != INTERPRET_YIELD) continue;
+
+            runSlice(scheduler, task);
+            if (task->result != INTERPRET_YIELD) running--;
+        }
+    }
+
+    switchVM(&host);
+}
+
+static const char* resultName(Task* task) {
+    if (task->timedOut) return "timeout";
+    switch (task->result) {
+        case INTERPRET_OK:            return "ok";
+        case INTERPRET_COMPILE_ERROR: return "compile";
+        case INTERPRET_RUNTIME_ERROR: return "runtime";
+        case INTERPRET_YIELD:         return "unfinished";
+    }
+    return "?";
+}
+
+void printTaskStats(Scheduler* scheduler, FILE* file) {
+    fprintf(file, "%-24s %-10s %14s %10s %8s %12s\n", "task", "result",
+            "instructions", "cpu ms", "slices", "max wait ms");
+    for (int i = 0; i < scheduler->count; i++) {
+        Task* task = &scheduler->tasks[i];
+        fprintf(file, "%-24s %-10s %14llu %10.2f %8llu %12.2f\n",
+                task->name, resultName(task),
+                (unsigned long long)task->instructions, task->cpuMs,
+                (unsigned long long)task->slices, task->maxWaitMs);
+    }
+}
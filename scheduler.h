@@ -0,0 +1,46 @@
+#ifndef clox_scheduler_h
+#define clox_scheduler_h
+
+#include "common.h"
+#include "vm.h"
+
+/* Many scripts sharing one thread, each in a VM context of its own
+ * (globals, objects, stack, output), taking turns round-robin.
+ *
+ * A task runs until it has used up `sliceInstructions`, then yields at
+ * its next loop back-edge or call, so no script can hold on to the
+ * thread. Contexts are swapped in and out of the thread's `vm`. A task
+ * that has used more than `timeoutMs` of CPU time is stopped with an
+ * error; the others carry on. */
+#define SCHEDULER_DEFAULT_SLICE 10000
+
+typedef struct {
+    VM              vm;     // The task's context, while it isn't running.
+    const char*     name;
+    InterpretResult result; // INTERPRET_YIELD until it finishes.
+    bool            timedOut;
+
+    // Accounting.
+    uint64_t        instructions;
+    double          cpuMs;
+    uint64_t        slices;
+    double          maxWaitMs;   // Longest wait between two turns.
+    double          lastRanAt;   // When its last turn ended (wall ms).
+} Task;
+
+typedef struct {
+    Task*    tasks;
+    int      count;
+    int      capacity;
+    uint64_t sliceInstructions;
+    double   timeoutMs; // Per task, in CPU time; 0 for no limit.
+} Scheduler;
+
+void initScheduler(Scheduler* scheduler);
+void freeScheduler(Scheduler* scheduler);
+int  spawnTask(Scheduler* scheduler, const char* name,
+               const char* source);
+void runScheduler(Scheduler* scheduler);
+void printTaskStats(Scheduler* scheduler, FILE* file);
+
+#endif
@@ -0,0 +1,303 @@
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "bytecode.h"
+#include "compiler.h"
+#include "memory.h"
+#include "serve.h"
+#include "vm.h"
+
+static bool readFull(int fd, void* buffer, size_t length) {
+    uint8_t* bytes = buffer;
+    while (length > 0) {
+        ssize_t got = read(fd, bytes, length);
+        if (got < 0 && errno == EINTR) continue;
+        if (got <= 0) return false;
+        bytes  += got;
+        length -= (size_t)got;
+    }
+    return true;
+}
+
+static bool writeFull(int fd, const void* buffer, size_t length) {
+    const uint8_t* bytes = buffer;
+    while (length > 0) {
+        ssize_t wrote = write(fd, bytes, length);
+        if (wrote < 0 && errno == EINTR) continue;
+        if (wrote <= 0) return false;
+        bytes  += wrote;
+        length -= (size_t)wrote;
+    }
+    return true;
+}
+
+static bool readU32(int fd, uint32_t* value) {
+    uint8_t bytes[4];
+    if (!readFull(fd, bytes, 4)) return false;
+    *value = (uint32_t)bytes[0] | (uint32_t)bytes[1] << 8 |
+             (uint32_t)bytes[2] << 16 | (uint32_t)bytes[3] << 24;
+    return true;
+}
+
+static bool writeU32(int fd, uint32_t value) {
+    uint8_t bytes[4] = {value, value >> 8, value >> 16, value >> 24};
+    return writeFull(fd, bytes, 4);
+}
+
+static bool writeBlock(int fd, const char* bytes, size_t length) {
+    return writeU32(fd, (uint32_t)length) && writeFull(fd, bytes, length);
+}
+
+/* Run one request on this thread's VM, with its output and errors
+ * captured in memory. */
+static uint8_t runRequest(uint8_t kind, char* payload, uint32_t length,
+                          char** out, size_t* outLength,
+                          char** err, size_t* errLength) {
+    FILE* outFile = open_memstream(out, outLength);
+    FILE* errFile = open_memstream(err, errLength);
+    vm.output.file = outFile;
+    vm.errors      = errFile;
+
+    uint8_t status;
+    if (kind == SERVE_SOURCE) {
+        payload[length] = '\0';
+        status = (uint8_t)interpret(payload);
+    } else {
+        // Verified as it's read, so a client can't send code that
+        // would run outside its chunk or the stack.
+        ObjFunction* function = readBytecode((uint8_t*)payload, length);
+        if (function == NULL) {
+            fprintf(errFile, "Malformed bytecode.\n");
+            status = SERVE_BAD_REQUEST;
+        } else {
+            status = (uint8_t)interpretFunction(function);
+        }
+    }
+
+    flushOutput(&vm.output);
+    vm.output.file = stdout;
+    vm.errors      = stderr;
+    fclose(outFile);
+    fclose(errFile);
+
+    // Drop everything the script made but its strings, which the
+    // next request probably shares some of. Those go too once there
+    // are enough of them, so a long-running daemon doesn't keep every
+    // string it has ever seen.
+    resetVMKeepingStrings(SERVE_MAX_STRINGS);
+    return status;
+}
+
+/* Serve requests on one connection until the client hangs up. */
+static void serveConnection(int fd) {
+    for (;;) {
+        uint8_t  kind;
+        uint32_t length;
+        if (!readFull(fd, &kind, 1) || !readU32(fd, &length)) return;
+
+        if ((kind != SERVE_SOURCE && kind != SERVE_BYTECODE) ||
+                length > SERVE_MAX_REQUEST) {
+            static const char message[] = "Bad request.\n";
+            uint8_t status = SERVE_BAD_REQUEST;
+            writeFull(fd, &status, 1);
+            writeBlock(fd, "", 0);
+            writeBlock(fd, message, sizeof(message) - 1);
+            return;
+        }
+
+        // One spare byte to terminate source with.
+        char* payload = ALLOCATE(char, length + 1);
+        if (!readFull(fd, payload, length)) {
+            FREE_ARRAY(char, payload, length + 1);
+            return;
+        }
+
+        char*  out = NULL;
+        char*  err = NULL;
+        size_t outLength = 0;
+        size_t errLength = 0;
+        uint8_t status = runRequest(kind, payload, length,
+                                    &out, &outLength, &err, &errLength);
+        FREE_ARRAY(char, payload, length + 1);
+
+        bool sent = writeFull(fd, &status, 1) &&
+                    writeBlock(fd, out, outLength) &&
+                    writeBlock(fd, err, errLength);
+        free(out);
+        free(err);
+        if (!sent) return;
+    }
+}
+
+typedef struct {
+    int       listener;
+    const VM* settings; // The main thread's VM, to copy options from.
+} ServeThread;
+
+static void* serveLoop(void* argument) {
+    ServeThread* thread = argument;
+
+    // Each thread has its own VM; give it the same options as the
+    // one main() set up.
+    if (&vm != thread->settings) {
+        initVM();
+        vm.globals.incremental  = thread->settings->globals.incremental;
+        vm.strings.incremental  = thread->settings->strings.incremental;
+        vm.output.lineBuffered  = thread->settings->output.lineBuffered;
+        vm.output.shortestNumbers =
+            thread->settings->output.shortestNumbers;
+        vm.pipelineScanner = thread->settings->pipelineScanner;
+        setOutputCapacity(&vm.output, thread->settings->output.capacity);
+    }
+
+    for (;;) {
+        int fd = accept(thread->listener, NULL, NULL);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            perror("accept");
+            break;
+        }
+        serveConnection(fd);
+        close(fd);
+    }
+
+    if (&vm != thread->settings) freeVM();
+    return NULL;
+}
+
+static int listenOn(const char* socketPath) {
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (strlen(socketPath) >= sizeof(address.sun_path)) {
+        fprintf(stderr, "Socket path too long: \"%s\".\n", socketPath);
+        return -1;
+    }
+    strcpy(address.sun_path, socketPath);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        perror("socket");
+        return -1;
+    }
+
+    // Replace a socket left behind by an earlier daemon.
+    unlink(socketPath);
+    if (bind(fd, (struct sockaddr*)&address, sizeof(address)) != 0 ||
+            listen(fd, SOMAXCONN) != 0) {
+        perror(socketPath);
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/* Serve requests on `socketPath` with `threads` VMs, one per thread,
+ * all taking connections from the same socket. The calling thread's
+ * VM is one of them. Only returns if the socket fails. */
+int serve(const char* socketPath, int threads) {
+    // A client hanging up mid-response mustn't kill the daemon.
+    signal(SIGPIPE, SIG_IGN);
+
+    int listener = listenOn(socketPath);
+    if (listener < 0) return 74;
+
+    ServeThread thread = {listener, &vm};
+    for (int i = 1; i < threads; i++) {
+        pthread_t id;
+        if (pthread_create(&id, NULL, serveLoop, &thread) != 0) {
+            fprintf(stderr, "Could not start serve thread.\n");
+            return 71;
+        }
+        pthread_detach(id);
+    }
+    serveLoop(&thread);
+
+    close(listener);
+    return 74;
+}
+
+static int connectTo(const char* socketPath) {
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (strlen(socketPath) >= sizeof(address.sun_path)) return -1;
+    strcpy(address.sun_path, socketPath);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) return -1;
+    if (connect(fd, (struct sockaddr*)&address, sizeof(address)) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/* Read a length-prefixed block of the response and copy it to `file`. */
+static bool relayBlock(int fd, FILE* file) {
+    uint32_t length;
+    if (!readU32(fd, &length)) return false;
+
+    char buffer[8192];
+    while (length > 0) {
+        size_t chunk = length < sizeof(buffer) ? length : sizeof(buffer);
+        if (!readFull(fd, buffer, chunk)) return false;
+        fwrite(buffer, 1, chunk, file);
+        length -= (uint32_t)chunk;
+    }
+    fflush(file);
+    return true;
+}
+
+/* Send `source` to the daemon on `socketPath`, compiled here first if
+ * `sendBytecode` is set, and print what comes back. Returns the exit
+ * code running the script locally would have had. */
+int runClient(const char* socketPath, const char* source,
+              bool sendBytecode) {
+    int fd = connectTo(socketPath);
+    if (fd < 0) {
+        fprintf(stderr, "Could not connect to \"%s\".\n", socketPath);
+        return 69;
+    }
+
+    uint8_t  kind   = SERVE_SOURCE;
+    uint8_t* bytes  = (uint8_t*)source;
+    size_t   length = strlen(source);
+    if (sendBytecode) {
+        ObjFunction* function = compile(source);
+        if (function == NULL) {
+            close(fd);
+            return 65;
+        }
+        kind  = SERVE_BYTECODE;
+        bytes = writeBytecode(function, &length);
+    }
+
+    bool sent = writeFull(fd, &kind, 1) &&
+                writeU32(fd, (uint32_t)length) &&
+                writeFull(fd, bytes, length);
+    if (sendBytecode) FREE_ARRAY(uint8_t, bytes, length);
+
+    uint8_t status = SERVE_BAD_REQUEST;
+    if (!sent || !readFull(fd, &status, 1) ||
+            !relayBlock(fd, stdout) || !relayBlock(fd, stderr)) {
+        fprintf(stderr, "Lost connection to \"%s\".\n", socketPath);
+        close(fd);
+        return 74;
+    }
+    close(fd);
+
+    switch (status) {
+        case INTERPRET_OK:            return 0;
+        case INTERPRET_COMPILE_ERROR: return 65;
+        case INTERPRET_RUNTIME_ERROR: return 76;
+        default:                      return 70;
+    }
+}
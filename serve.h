@@ -0,0 +1,39 @@
+#ifndef clox_serve_h
+#define clox_serve_h
+
+#include "common.h"
+
+/* A daemon that keeps warm VMs around to run scripts sent to it over
+ * a Unix socket, and the client side of it.
+ *
+ * A connection carries any number of requests, one after the other:
+ *
+ *     request:  kind (1 byte)   'S' source or 'B' bytecode.h bytecode
+ *               length (u32)
+ *               payload
+ *
+ *     response: status (1 byte) an InterpretResult, or
+ *                               SERVE_BAD_REQUEST
+ *               length (u32), then what the script printed
+ *               length (u32), then its error messages
+ *
+ * Lengths are little-endian. Each request runs on a VM reset to a
+ * clean state, except that it keeps its interned strings warm: names
+ * and literals that requests have in common are found straight away
+ * in vm.strings. A VM only gives its strings back once it holds more
+ * than SERVE_MAX_STRINGS of them. */
+#define SERVE_SOURCE      'S'
+#define SERVE_BYTECODE    'B'
+#define SERVE_BAD_REQUEST 3
+
+// Requests bigger than this are refused.
+#define SERVE_MAX_REQUEST (64 * 1024 * 1024)
+
+// How many interned strings a VM keeps between requests.
+#define SERVE_MAX_STRINGS (64 * 1024)
+
+int serve(const char* socketPath, int threads);
+int runClient(const char* socketPath, const char* source,
+              bool sendBytecode);
+
+#endif
@@ -1,163 +1,589 @@
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include "memory.h"
 #include "object.h"
 #include "table.h"
+#include "trace.h"
 #include "value.h"
 
 #define TABLE_MAX_LOAD 0.75
 
+// How much of an incremental resize tableSet/tableDelete do: for
+// every write, move up to TABLE_MIGRATE_ENTRIES entries, looking at no
+// more than TABLE_MIGRATE_SCAN old slots. The old arrays of capacity C
+// hold at most 0.75C entries, so migrating takes at most 0.094C + C/512
+// writes. Even if every one of those writes adds a key, the doubled
+// table is then under 0.85C full, well short of its 1.5C limit, so two
+// migrations never overlap.
+//
+// The work is done in batches, once every TABLE_MIGRATE_EVERY writes
+// (more often for small tables), rather than a little on every write.
+// Moving an entry is a cache miss in the new arrays, and a few of
+// those on every write would slow down the typical write, not just
+// the slowest.
+#define TABLE_MIGRATE_ENTRIES 8
+#define TABLE_MIGRATE_SCAN    512
+#define TABLE_MIGRATE_EVERY   256
+
+// Once an incremental table is this full, inserts start clearing the
+// doubled arrays, TABLE_PREPARE_SLOTS slots at a time, to have them
+// ready by the time it grows. Clearing them also faults their pages
+// in, which is most of what a resize of a big table costs.
+#define TABLE_PREPARE_LOAD  0.625
+#define TABLE_PREPARE_SLOTS 4096
+
+// Control bytes. A full slot holds `h2` of its key: 0x00-0x7F.
+#define CTRL_EMPTY   0x80
+#define CTRL_DELETED 0xFE
+
+// The top bits of the hash pick the group, the low 7 bits are stored
+// in the control byte so that most mismatches are filtered out there.
+#define H1(hash) ((hash) >> 7)
+#define H2(hash) ((uint8_t)((hash) & 0x7F))
+
+#define IS_FULL(control) (((control) & 0x80) == 0)
+
+#ifdef PROBE_STATS
+_Thread_local uint64_t tableProbes = 0;
+#define COUNT_PROBE() (tableProbes++)
+#else
+#define COUNT_PROBE() ((void)0)
+#endif
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+
+/* Bitmask of the slots in a group whose control byte is `byte`. */
+static inline uint32_t matchByte(const uint8_t* group, uint8_t byte) {
+    __m128i ctrl = _mm_loadu_si128((const __m128i*)group);
+    __m128i eq   = _mm_cmpeq_epi8(ctrl, _mm_set1_epi8((char)byte));
+    return (uint32_t)_mm_movemask_epi8(eq);
+}
+
+/* EMPTY and DELETED are the only control bytes with the top bit set. */
+static inline uint32_t matchFree(const uint8_t* group) {
+    __m128i ctrl = _mm_loadu_si128((const __m128i*)group);
+    return (uint32_t)_mm_movemask_epi8(ctrl);
+}
+#else
+static inline uint32_t matchByte(const uint8_t* group, uint8_t byte) {
+    uint32_t mask = 0;
+    for (int i = 0; i < TABLE_GROUP_WIDTH; ++i) {
+        if (group[i] == byte) mask |= 1u << i;
+    }
+    return mask;
+}
+
+static inline uint32_t matchFree(const uint8_t* group) {
+    uint32_t mask = 0;
+    for (int i = 0; i < TABLE_GROUP_WIDTH; ++i) {
+        if (!IS_FULL(group[i])) mask |= 1u << i;
+    }
+    return mask;
+}
+#endif
+
+// Pop the lowest set bit of a match mask, returning its index.
+#define NEXT_MATCH(mask, bit) \
+    ((bit) = __builtin_ctz(mask), (mask) &= (mask) - 1, (bit))
+
 void initTable(Table* table) {
-    table->count    = 0;
-    table->capacity = 0;
-    table->entries  = NULL;
+    table->count       = 0;
+    table->capacity    = 0;
+    table->entries     = NULL;
+    table->control     = NULL;
+    table->incremental = false;
+    table->oldCapacity = 0;
+    table->migrated    = 0;
+    table->writes      = 0;
+    table->oldEntries  = NULL;
+    table->oldControl  = NULL;
+    table->prepared    = 0;
+    table->nextEntries = NULL;
+    table->nextControl = NULL;
+    table->stats       = NULL;
 }
 
 void freeTable(Table* table) {
+    if (table->stats != NULL) FREE(TableStats, table->stats);
     FREE_ARRAY(Entry, table->entries, table->capacity);
+    FREE_ARRAY(uint8_t, table->control, table->capacity);
+    FREE_ARRAY(Entry, table->oldEntries, table->oldCapacity);
+    FREE_ARRAY(uint8_t, table->oldControl, table->oldCapacity);
+    FREE_ARRAY(Entry, table->nextEntries, table->capacity * 2);
+    FREE_ARRAY(uint8_t, table->nextControl, table->capacity * 2);
     initTable(table);
 }
 
-/* Find an entry in the hashtable; create one if none exists.
+static inline bool isMigrating(Table* table) {
+    return table->oldEntries != NULL;
+}
+
+static inline bool isEmpty(Table* table) {
+    return table->count == 0 && !isMigrating(table);
+}
+
+/* Find the slot holding `key`, or -1 if it isn't in the arrays.
  *
- * the map uses linear probing. In case of a collision, check 
- * successive buckets are checked for the value. If no entry
- * is found, a new one is initialized and it's pointer returned. */ 
-static Entry* findEntry(Entry* entries, int capacity,
-                        ObjString* key) {
-    uint32_t index   = key->hash % capacity;
-    Entry* tombstone = NULL;
- 
-    for (;;) {
-        Entry* entry = &entries[index];
-        
-        if (entry->key == NULL) {
-            if (IS_NIL(entry->value)) {
-                // Empty entry.
-                return tombstone != NULL ? tombstone : entry;
-            } else {
-                // We found a tombstone.
-                if (tombstone == NULL) tombstone = entry;
+ * Groups are visited in triangular order (+1, +2, +3 ... groups),
+ * which covers every group of a power-of-two table. A group with an
+ * EMPTY slot ends the search: the key would have been put there. */
+static int findSlot(Entry* entries, uint8_t* controls, int capacity,
+                    ObjString* key) {
+    if (capacity == 0) return -1;
+
+    int      groupMask = (capacity / TABLE_GROUP_WIDTH) - 1;
+    uint32_t group     = H1(key->hash) & groupMask;
+    uint8_t  h2        = H2(key->hash);
+
+    for (int step = 1;; ++step) {
+        COUNT_PROBE();
+        int      base    = group * TABLE_GROUP_WIDTH;
+        uint8_t* control = &controls[base];
+
+        uint32_t mask = matchByte(control, h2);
+        while (mask != 0) {
+            int bit;
+            int slot = base + NEXT_MATCH(mask, bit);
+            // Strings are interned, so comparing pointers is enough.
+            if (entries[slot].key == key) return slot;
+        }
+        if (matchByte(control, CTRL_EMPTY) != 0) return -1;
+
+        group = (group + step) & groupMask;
+    }
+}
+
+/* Find the first EMPTY or DELETED slot on `hash`'s probe sequence. */
+static int findFreeSlot(uint8_t* controls, int capacity, uint32_t hash) {
+    int      groupMask = (capacity / TABLE_GROUP_WIDTH) - 1;
+    uint32_t group     = H1(hash) & groupMask;
+
+    for (int step = 1;; ++step) {
+        COUNT_PROBE();
+        int      base = group * TABLE_GROUP_WIDTH;
+        uint32_t mask = matchFree(&controls[base]);
+        if (mask != 0) return base + __builtin_ctz(mask);
+
+        group = (group + step) & groupMask;
+    }
+}
+
+/* Look `key` up in the old arrays. Migrated slots are tombstoned, so
+ * only keys which haven't been moved yet can be found here. */
+static int findOldSlot(Table* table, ObjString* key) {
+    if (!isMigrating(table)) return -1;
+
+    return findSlot(table->oldEntries, table->oldControl,
+                    table->oldCapacity, key);
+}
+
+/* How many groups a lookup of the string would look at in the current
+ * arrays. This walks the probe sequence again rather than having every
+ * lookup count as it goes, so tables that aren't tracking stats pay
+ * nothing for it. */
+static int probeLength(Table* table, const char* chars, int length,
+                       uint32_t hash) {
+    if (table->capacity == 0) return 0;
+
+    int      groupMask = (table->capacity / TABLE_GROUP_WIDTH) - 1;
+    uint32_t group     = H1(hash) & groupMask;
+    uint8_t  h2        = H2(hash);
+
+    for (int step = 1;; ++step) {
+        int      base    = group * TABLE_GROUP_WIDTH;
+        uint8_t* control = &table->control[base];
+
+        uint32_t mask = matchByte(control, h2);
+        while (mask != 0) {
+            int bit;
+            ObjString* key = table->entries[base + NEXT_MATCH(mask, bit)].key;
+            if (key->hash == hash && key->length == length &&
+                    memcmp(key->chars, chars, length) == 0) {
+                return step;
             }
-        } else if (entry->key == key) {
-            // We found the key
-            return entry;
         }
+        if (matchByte(control, CTRL_EMPTY) != 0) return step;
+
+        group = (group + step) & groupMask;
+    }
+}
+
+static void recordKeyProbes(Table* table, ObjString* key) {
+    recordProbes(table->stats,
+                 probeLength(table, key->chars, key->length, key->hash));
+}
+
+/* Place an entry known not to be in the table yet. */
+static void insertEntry(Table* table, ObjString* key, Value value) {
+    int slot = findFreeSlot(table->control, table->capacity, key->hash);
+    // Reusing a tombstone doesn't change the load.
+    if (table->control[slot] == CTRL_EMPTY) table->count++;
+
+    table->control[slot]       = H2(key->hash);
+    table->entries[slot].key   = key;
+    table->entries[slot].value = value;
+}
 
-        // TODO comparing strings with `==`!?
-        if (entry->key == key || entry->key == NULL) {
-            return entry;
-        }   
+/* Move the next few old entries into the new arrays, freeing the old
+ * arrays once everything has been moved. Free slots are skipped a
+ * group at a time, so each call does a small, bounded amount of work
+ * however full or sparse the old arrays are. */
+static void migrate(Table* table, int entries, int scan) {
+    int slot  = table->migrated;
+    int limit = slot + scan;
+    if (limit > table->oldCapacity) limit = table->oldCapacity;
 
-        // Loop around to the start of the array.
-        // Necessary to avoid trying to find the key outside of
-        // the table's bounds in memory.
-        index = (index + 1) % capacity;
+    while (slot < limit && entries > 0) {
+        int      base = slot & ~(TABLE_GROUP_WIDTH - 1);
+        uint32_t full = ~matchFree(&table->oldControl[base]) &
+                        ((1u << TABLE_GROUP_WIDTH) - 1);
+        full &= ~0u << (slot - base); // Skip the ones already moved.
+        slot = base + TABLE_GROUP_WIDTH;
+
+        // Match the group once. Reloading it after storing tombstones
+        // into it would wait for those stores, and so for the cache
+        // misses before them, which then can't overlap.
+        while (full != 0) {
+            if (entries == 0) {
+                slot = base + __builtin_ctz(full);
+                break;
+            }
+            int    bit;
+            int    i     = base + NEXT_MATCH(full, bit);
+            Entry* entry = &table->oldEntries[i];
+            insertEntry(table, entry->key, entry->value);
+            table->oldControl[i] = CTRL_DELETED;
+            entries--;
+        }
+    }
+    table->migrated = slot;
+
+    if (table->migrated >= table->oldCapacity) {
+        FREE_ARRAY(Entry, table->oldEntries, table->oldCapacity);
+        FREE_ARRAY(uint8_t, table->oldControl, table->oldCapacity);
+        table->oldEntries  = NULL;
+        table->oldControl  = NULL;
+        table->oldCapacity = 0;
+        table->migrated    = 0;
     }
 }
 
+static inline void migrateSome(Table* table) {
+    if (!isMigrating(table)) return;
+
+    // Small tables migrate on every write. Only falling behind by a
+    // fraction of the capacity keeps the bound above.
+    int every = table->oldCapacity / TABLE_MIGRATE_SCAN;
+    if (every > TABLE_MIGRATE_EVERY) every = TABLE_MIGRATE_EVERY;
+    if (++table->writes < every) return;
+
+    table->writes = 0;
+    if (every < 1) every = 1;
+    migrate(table, every * TABLE_MIGRATE_ENTRIES,
+            every * TABLE_MIGRATE_SCAN);
+}
+
 /* Create a new object from the retrieved value, if one exists.
  *
  * Return true if the key is found, otherwise false. */
 bool tableGet(Table* table, ObjString* key, Value* value) {
-    if (table->count == 0) return false;
+    if (isEmpty(table)) return false;
+
+    if (table->stats != NULL) recordKeyProbes(table, key);
+    int slot = findSlot(table->entries, table->control, table->capacity,
+                        key);
+    if (slot >= 0) {
+        *value = table->entries[slot].value;
+        return true;
+    }
+
+    slot = findOldSlot(table, key);
+    if (slot < 0) return false;
 
-    Entry* entry = findEntry(table->entries, table->capacity, key);
-    if (entry->key == NULL) return false;
-    
-    *value = entry->value;
+    *value = table->oldEntries[slot].value;
     return true;
 }
 
 /* Delete a key from the table
  * 
- * Returns true if a key was tombstoned, false otherwise. */
+ * Returns true if a key was removed, false otherwise. */
 bool tableDelete(Table* table, ObjString* key) {
-    if (table->count == 0) return false;
+    if (isEmpty(table)) return false;
+    migrateSome(table);
 
     // Does the entry exist?
-    Entry* entry = findEntry(table->entries, table->capacity, key);
-    if (entry->key == NULL) return false;
-
-    // Create a sentinel 'tombstone' entry.
-    // This is because linear probing may require this entry to
-    // be set in order to find subsequent values properly.
-    entry->key   = NULL;
-    entry->value = BOOL_VAL(true);
-  
+    if (table->stats != NULL) recordKeyProbes(table, key);
+    int slot = findSlot(table->entries, table->control, table->capacity,
+                        key);
+    if (slot < 0) {
+        // Nothing probes the old arrays for free slots, so a plain
+        // tombstone is enough there.
+        slot = findOldSlot(table, key);
+        if (slot < 0) return false;
+
+        table->oldControl[slot] = CTRL_DELETED;
+        return true;
+    }
+
+    // A group which still has an EMPTY slot has never been full, so
+    // no probe sequence has ever run past it and the slot can simply
+    // be emptied. Otherwise leave a tombstone so later groups on the
+    // same probe sequence stay reachable.
+    uint8_t* group = &table->control[slot & ~(TABLE_GROUP_WIDTH - 1)];
+    if (matchByte(group, CTRL_EMPTY) != 0) {
+        table->control[slot] = CTRL_EMPTY;
+        table->count--;
+    } else {
+        table->control[slot] = CTRL_DELETED;
+    }
+    table->entries[slot].key   = NULL;
+    table->entries[slot].value = NIL_VAL;
+
     return true;
 }
 
+/* Rebuild the table at a new capacity, dropping any tombstones. */
 static void adjustCapacity(Table* table, int capacity) {
-    Entry* entries = ALLOCATE(Entry, capacity);
-    for (int i = 0; i< capacity; i++) {
-        entries[i].key = NULL;
-        entries[i].value = NIL_VAL;
-    }
-    table->entries  = entries;
-    table->capacity = capacity;
+    Entry*   entries  = ALLOCATE(Entry, capacity);
+    uint8_t* controls = ALLOCATE(uint8_t, capacity);
+    memset(controls, CTRL_EMPTY, capacity);
 
+    table->count = 0;
     for (int i = 0; i < table->capacity; ++i) {
-        Entry* entry = &table->entries[i];
-        // There was no entry in our old table here, continue. 
-        if (entry->key == NULL) continue;
+        // There was no entry in our old table here, continue.
+        if (!IS_FULL(table->control[i])) continue;
 
-        Entry* dest = findEntry(entries, capacity, entry->key);
-        dest->key   = entry->key;
-        dest->value = entry->value;
+        Entry*   entry = &table->entries[i];
+        uint32_t hash  = entry->key->hash;
+        int      dest  = findFreeSlot(controls, capacity, hash);
+        controls[dest] = H2(hash);
+        entries[dest]  = *entry;
         table->count++;
     }
 
     FREE_ARRAY(Entry, table->entries, table->capacity);
+    FREE_ARRAY(uint8_t, table->control, table->capacity);
     table->entries  = entries;
+    table->control  = controls;
     table->capacity = capacity;
 }
 
+/* Clear the next TABLE_PREPARE_SLOTS slots of the doubled arrays. */
+static void prepareChunk(Table* table) {
+    int capacity = table->capacity * 2;
+    if (table->nextEntries == NULL) {
+        table->nextEntries = ALLOCATE(Entry, capacity);
+        table->nextControl = ALLOCATE(uint8_t, capacity);
+        table->prepared    = 0;
+    }
+
+    int from = table->prepared;
+    int to   = from + TABLE_PREPARE_SLOTS;
+    if (to > capacity) to = capacity;
+    memset(&table->nextControl[from], CTRL_EMPTY, to - from);
+    memset(&table->nextEntries[from], 0, sizeof(Entry) * (to - from));
+    table->prepared = to;
+}
+
+/* Keep the doubled arrays' preparation ahead of the table filling up:
+ * it's finished by the time the table is halfway from
+ * TABLE_PREPARE_LOAD to TABLE_MAX_LOAD. */
+static void prepareGrowth(Table* table) {
+    int start = (int)(table->capacity * TABLE_PREPARE_LOAD);
+    int end   = (int)(table->capacity *
+                      (TABLE_PREPARE_LOAD + TABLE_MAX_LOAD) / 2);
+    if (table->count < start || isMigrating(table)) return;
+    if (table->nextEntries != NULL &&
+            table->prepared == table->capacity * 2) {
+        return;
+    }
+
+    int64_t goal = end > start
+        ? (int64_t)table->capacity * 2 * (table->count - start + 1) /
+              (end - start)
+        : table->capacity * 2;
+    if (table->nextEntries == NULL || table->prepared < goal) {
+        prepareChunk(table);
+    }
+}
+
+/* Swap in empty arrays of the new capacity, keeping the current ones
+ * as the old arrays to be migrated a few slots at a time. */
+static void beginMigration(Table* table, int capacity) {
+    // Normally prepareGrowth() has already done this.
+    while (table->nextEntries == NULL || table->prepared < capacity) {
+        prepareChunk(table);
+    }
+
+    table->oldEntries  = table->entries;
+    table->oldControl  = table->control;
+    table->oldCapacity = table->capacity;
+    table->migrated    = 0;
+
+    table->entries     = table->nextEntries;
+    table->control     = table->nextControl;
+    table->capacity    = capacity;
+    table->count       = 0;
+    table->nextEntries = NULL;
+    table->nextControl = NULL;
+    table->prepared    = 0;
+}
+
+static void growTable(Table* table) {
+    // Can't happen with the migration rate above, but never run two
+    // migrations at once.
+    if (isMigrating(table)) {
+        migrate(table, table->oldCapacity, table->oldCapacity);
+    }
+
+    int capacity = table->capacity < TABLE_GROUP_WIDTH
+        ? TABLE_GROUP_WIDTH : table->capacity * 2;
+
+    if (table->stats != NULL) table->stats->resizes++;
+
+    double start       = traceEnabled ? traceNow() : 0;
+    int    oldCapacity = table->capacity;
+    bool   incremental = table->incremental && table->capacity > 0;
+    if (incremental) {
+        beginMigration(table, capacity);
+    } else {
+        adjustCapacity(table, capacity);
+    }
+
+    if (traceEnabled) {
+        char args[64];
+        snprintf(args, sizeof(args), "\"old\":%d,\"new\":%d",
+                 oldCapacity, capacity);
+        traceSpan(incremental ? "beginMigration" : "adjustCapacity",
+                  start, args);
+        traceCounters();
+    }
+}
+
 /* Insert a key-value pair into a hashtable */
 bool tableSet(Table* table, ObjString* key, Value value) {
+    migrateSome(table);
+
+    if (table->stats != NULL) recordKeyProbes(table, key);
+    int slot = findSlot(table->entries, table->control, table->capacity,
+                        key);
+    if (slot >= 0) {
+        table->entries[slot].value = value;
+        return false;
+    }
+
+    // A key still waiting in the old arrays gets moved across now.
+    bool isNewKey = true;
+    slot = findOldSlot(table, key);
+    if (slot >= 0) {
+        table->oldControl[slot] = CTRL_DELETED;
+        isNewKey = false;
+    }
+
     if (table->count + 1 > table->capacity * TABLE_MAX_LOAD) {
-        int capacity = GROW_CAPACITY(table->capacity);
-        adjustCapacity(table, capacity);
+        growTable(table);
+    } else if (table->incremental) {
+        prepareGrowth(table);
     }
 
-    Entry* entry = findEntry(table->entries, table->capacity, key);
-    
-    bool isNewKey = entry->key == NULL;
-    if (isNewKey && IS_NIL(entry->value)) table->count++;
-    
-    entry->key   = key;
-    entry->value = value;
+    insertEntry(table, key, value);
     return isNewKey;
 }
 
 /* Copy the values from one table to another */
 void tableAddAll(Table* from, Table* to) {
     for (int i = 0; i < from->capacity; ++i) {
+        if (!IS_FULL(from->control[i])) continue;
+
         Entry* entry = &from->entries[i];
-        if (entry->key != NULL) {
-            tableSet(to, entry->key, entry->value);
+        tableSet(to, entry->key, entry->value);
+    }
+
+    for (int i = from->migrated; i < from->oldCapacity; ++i) {
+        if (!IS_FULL(from->oldControl[i])) continue;
+
+        Entry* entry = &from->oldEntries[i];
+        tableSet(to, entry->key, entry->value);
+    }
+}
+
+/* Call `visit` with every key in the table. */
+void tableEachKey(Table* table, void (*visit)(ObjString* key)) {
+    for (int i = 0; i < table->capacity; ++i) {
+        if (IS_FULL(table->control[i])) visit(table->entries[i].key);
+    }
+
+    for (int i = table->migrated; i < table->oldCapacity; ++i) {
+        if (IS_FULL(table->oldControl[i])) visit(table->oldEntries[i].key);
+    }
+}
+
+static ObjString* findString(Entry* entries, uint8_t* controls,
+                             int capacity, const char* chars,
+                             int length, uint32_t hash) {
+    if (capacity == 0) return NULL;
+
+    int      groupMask = (capacity / TABLE_GROUP_WIDTH) - 1;
+    uint32_t group     = H1(hash) & groupMask;
+    uint8_t  h2        = H2(hash);
+
+    for (int step = 1;; ++step) {
+        COUNT_PROBE();
+        int      base    = group * TABLE_GROUP_WIDTH;
+        uint8_t* control = &controls[base];
+
+        uint32_t mask = matchByte(control, h2);
+        while (mask != 0) {
+            int bit;
+            ObjString* key = entries[base + NEXT_MATCH(mask, bit)].key;
+            if (key->hash == hash && key->length == length &&
+                    memcmp(key->chars, chars, length) == 0) {
+                // Match found!
+                return key;
+            }
         }
+        // Stop if the group has an empty, non-tombstone, slot.
+        if (matchByte(control, CTRL_EMPTY) != 0) return NULL;
+
+        group = (group + step) & groupMask;
     }
 }
 
+/* Look a string up by its characters rather than by pointer.
+ *
+ * This is how strings get interned, so it can't rely on pointer
+ * equality like `findSlot` does. */
 ObjString* tableFindString(Table* table, const char* chars,
                           int length, uint32_t hash) {
-    if (table->count == 0) return NULL;
-
-    uint32_t index = hash % table->capacity;
-    
-    for (;;) {
-        Entry* entry = &table->entries[index];
-        if (entry->key == NULL) {
-            // Stop if we find an empty, non-tombstone, entry.
-            if (IS_NIL(entry->value)) return NULL;
-        } else if (entry->key->length == length &&
-                   memcmp(entry->key->chars, chars, length) == 0) {
-            // Match found!
-            return entry->key;
-        }
-        // Increment by one, looping around to the start if necessary
-        index = (index + 1) % table->capacity;
+    if (isEmpty(table)) return NULL;
+
+    if (table->stats != NULL) {
+        recordProbes(table->stats, probeLength(table, chars, length, hash));
     }
-}
\ No newline at end of file
+    ObjString* string = findString(table->entries, table->control,
+                                   table->capacity, chars, length, hash);
+    if (string != NULL || !isMigrating(table)) return string;
+
+    return findString(table->oldEntries, table->oldControl,
+                      table->oldCapacity, chars, length, hash);
+}
+
+/* Start keeping health counters (see TableStats) for `table`. */
+void tableTrackStats(Table* table) {
+    if (table->stats != NULL) return;
+    table->stats = ALLOCATE(TableStats, 1);
+    memset(table->stats, 0, sizeof(TableStats));
+}
+
+/* Tombstones in the table's current arrays. Only a resize clears
+ * them, so a table that sees many deletes collects them. */
+int tableTombstones(Table* table) {
+    int tombstones = 0;
+    for (int i = 0; i < table->capacity; ++i) {
+        if (table->control[i] == CTRL_DELETED) tombstones++;
+    }
+    return tombstones;
+}
@@ -9,18 +9,83 @@ typedef struct {
     Value      value;
 } Entry;
 
+// Probe lengths 1 to TABLE_STATS_BUCKETS - 1 each get a bucket of the
+// histogram; the last bucket is for anything longer.
+#define TABLE_STATS_BUCKETS 16
+
+/* Health counters for a hashtable, kept only when asked for (see
+ * tableTrackStats). A probe is a group of slots for a Table and a
+ * single slot for the intern table; a lookup's probe length is how
+ * many it looked at before finding the key or giving up. */
+typedef struct {
+    uint64_t lookups;
+    uint64_t probes;    // Summed over all lookups.
+    int      maxProbes;
+    int      resizes;
+    uint64_t histogram[TABLE_STATS_BUCKETS];
+} TableStats;
+
+static inline void recordProbes(TableStats* stats, int probes) {
+    stats->lookups++;
+    stats->probes += probes;
+    if (probes > stats->maxProbes) stats->maxProbes = probes;
+    stats->histogram[probes < TABLE_STATS_BUCKETS
+                         ? probes : TABLE_STATS_BUCKETS - 1]++;
+}
+
+/* Open-addressed hashtable in the style of Abseil's SwissTable.
+ *
+ * Alongside the entries is one control byte per slot which is either
+ * EMPTY, DELETED (a tombstone) or the low 7 bits of the key's hash.
+ * Slots are probed sixteen at a time by comparing a whole group of
+ * control bytes at once, so most misses never touch `entries`. */
 typedef struct {
-    int    count;
-    int    capacity;
-    Entry* entries;
+    int      count;    // Live entries plus tombstones.
+    int      capacity; // Zero, or a power of two >= TABLE_GROUP_WIDTH.
+    Entry*   entries;
+    uint8_t* control;
+
+    /* Incremental resizing. When `incremental` is set, growing the
+     * table keeps the previous arrays around and moves a few of their
+     * slots across every few tableSet/tableDelete calls (`writes`
+     * counts them) instead of rehashing everything at once. Slots
+     * before `migrated` have been moved, and the old arrays are freed
+     * once it reaches `oldCapacity`.
+     *
+     * The doubled arrays are prepared ahead of time too: as the table
+     * nears its load limit, inserts clear a chunk of `nextEntries` and
+     * `nextControl` at a time, so growing doesn't have to. The first
+     * `prepared` slots of them are ready. */
+    bool     incremental;
+    int      oldCapacity;
+    int      migrated;
+    int      writes;
+    Entry*   oldEntries;
+    uint8_t* oldControl;
+    int      prepared;
+    Entry*   nextEntries;
+    uint8_t* nextControl;
+
+    TableStats* stats; // NULL unless tracking them.
 } Table;
 
+#define TABLE_GROUP_WIDTH 16
+
+#ifdef PROBE_STATS
+// Groups of control bytes examined by lookups and inserts on this
+// thread. Only compiled in for the microbenchmarks.
+extern _Thread_local uint64_t tableProbes;
+#endif
+
 void initTable(Table* table);
 void freeTable(Table* table);
 bool tableGet(Table* table, ObjString* key, Value* value);
 bool tableSet(Table* table, ObjString* key, Value value);
 bool tableDelete(Table* table, ObjString* key);
 void tableAddAll(Table* from, Table* to);
+void tableEachKey(Table* table, void (*visit)(ObjString* key));
 ObjString* tableFindString(Table* table, const char* chars,
                            int length, uint32_t hash);
-#endif
\ No newline at end of file
+void tableTrackStats(Table* table);
+int  tableTombstones(Table* table);
+#endif
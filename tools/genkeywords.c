@@ -0,0 +1,99 @@
+/* Generate keywords.h: a perfect hash table of Lox's keywords.
+ *
+ * Keywords are hashed on their first character, last character and
+ * length only:
+ *
+ *     (first * FIRST_MUL + last * LAST_MUL + length) & mask
+ *
+ * We search for the smallest table and multipliers that give every
+ * keyword in keywords.def its own slot. The scanner then classifies
+ * an identifier with one hash and one compare against that slot. */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+    const char* name;
+    const char* type;
+} Keyword;
+
+static const Keyword keywords[] = {
+#define KEYWORD(name, type) {name, #type},
+#include "../keywords.def"
+#undef KEYWORD
+};
+
+#define KEYWORD_COUNT ((int)(sizeof(keywords) / sizeof(keywords[0])))
+#define MAX_SIZE      256
+#define MAX_MUL       64
+
+static int hashKeyword(const char* name, int firstMul, int lastMul,
+                       int mask) {
+    int length = (int)strlen(name);
+    unsigned first = (unsigned char)name[0];
+    unsigned last  = (unsigned char)name[length - 1];
+    return (int)((first * firstMul + last * lastMul + length) & mask);
+}
+
+static int isPerfect(int size, int firstMul, int lastMul) {
+    int used[MAX_SIZE] = {0};
+    for (int i = 0; i < KEYWORD_COUNT; ++i) {
+        int slot = hashKeyword(keywords[i].name, firstMul, lastMul,
+                               size - 1);
+        if (used[slot]++) return 0;
+    }
+    return 1;
+}
+
+int main() {
+    int minLength = 1 << 30, maxLength = 0;
+    for (int i = 0; i < KEYWORD_COUNT; ++i) {
+        int length = (int)strlen(keywords[i].name);
+        if (length < minLength) minLength = length;
+        if (length > maxLength) maxLength = length;
+    }
+
+    for (int size = 16; size <= MAX_SIZE; size *= 2) {
+        if (size < KEYWORD_COUNT) continue;
+
+        for (int firstMul = 1; firstMul < MAX_MUL; ++firstMul) {
+        for (int lastMul  = 0; lastMul  < MAX_MUL; ++lastMul) {
+            if (!isPerfect(size, firstMul, lastMul)) continue;
+
+            const Keyword* table[MAX_SIZE] = {NULL};
+            for (int i = 0; i < KEYWORD_COUNT; ++i) {
+                table[hashKeyword(keywords[i].name, firstMul, lastMul,
+                                  size - 1)] = &keywords[i];
+            }
+
+            printf("/* Generated by tools/genkeywords.c from "
+                   "keywords.def. Do not edit. */\n");
+            printf("#ifndef clox_keywords_h\n");
+            printf("#define clox_keywords_h\n\n");
+            printf("#define KEYWORD_MIN_LENGTH %d\n", minLength);
+            printf("#define KEYWORD_MAX_LENGTH %d\n\n", maxLength);
+            printf("#define KEYWORD_HASH(first, last, length) \\\n"
+                   "    (((unsigned)(first) * %du + "
+                   "(unsigned)(last) * %du + \\\n"
+                   "      (unsigned)(length)) & %du)\n\n",
+                   firstMul, lastMul, size - 1);
+            printf("typedef struct {\n"
+                   "    const char* name;\n"
+                   "    int         length; // Zero for an empty slot.\n"
+                   "    TokenType   type;\n"
+                   "} Keyword;\n\n");
+            printf("static const Keyword keywords[%d] = {\n", size);
+            for (int slot = 0; slot < size; ++slot) {
+                if (table[slot] == NULL) continue;
+                printf("    [%2d] = {\"%s\", %d, %s},\n", slot,
+                       table[slot]->name, (int)strlen(table[slot]->name),
+                       table[slot]->type);
+            }
+            printf("};\n\n#endif\n");
+            return 0;
+        }}
+    }
+
+    fprintf(stderr, "genkeywords: no perfect hash found.\n");
+    return 1;
+}
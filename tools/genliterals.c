@@ -0,0 +1,62 @@
+/* Generate bench/literals.lox: a large script that is nearly all
+ * number literals, for timing the scanner, number parser and compiler.
+ *
+ * A chunk holds at most 256 constants, so the literals are spread over
+ * many small functions, nested inside a few outer ones so the top-level
+ * script doesn't run out of constants either. Only one inner function
+ * per outer one is called; the rest are just compiled.
+ *
+ * The output is the same on every run. */
+#include <stdio.h>
+#include <stdint.h>
+
+#define OUTER     40
+#define INNER     50
+#define LITERALS  100
+
+static uint64_t state = 0x2545F4914F6CDD1Dull;
+
+static uint64_t next() {
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    return state;
+}
+
+/* A literal in one of the shapes real code has: small integers,
+ * decimals, long fractions and long integers. (Lox has no exponent
+ * syntax.) */
+static void printLiteral() {
+    uint64_t r = next();
+    switch (r % 4) {
+        case 0: printf("%u", (unsigned)((r >> 8) % 1000)); break;
+        case 1: printf("%u.%u", (unsigned)((r >> 8) % 10000),
+                       (unsigned)((r >> 24) % 100)); break;
+        case 2: printf("0.%09u", (unsigned)((r >> 8) % 1000000000)); break;
+        case 3: printf("%llu", (unsigned long long)(r >> 12)); break;
+    }
+}
+
+int main() {
+    printf("// Generated by tools/genliterals.c. Do not edit.\n");
+    printf("var total = 0;\n");
+
+    for (int outer = 0; outer < OUTER; outer++) {
+        printf("fun outer%d() {\n", outer);
+        for (int inner = 0; inner < INNER; inner++) {
+            printf("    fun inner%d() {\n        return ", inner);
+            for (int literal = 0; literal < LITERALS; literal++) {
+                if (literal > 0) {
+                    printf(literal % 5 == 0 ? " +\n            " : " + ");
+                }
+                printLiteral();
+            }
+            printf(";\n    }\n");
+        }
+        printf("    return inner0();\n}\n");
+        printf("total = total + outer%d();\n", outer);
+    }
+
+    printf("print total;\n");
+    return 0;
+}
@@ -0,0 +1,244 @@
+/* Generate pow5table.h: 128-bit approximations of powers of five
+ * used by number.c.
+ *
+ * pow5table is for the Eisel-Lemire parser. For q >= 0 each entry is
+ * 5^q shifted so its top bit is bit 127 and truncated to 128 bits.
+ * For q < 0 it is 2^b / 5^-q rounded up, with b picked so the result
+ * also fills 128 bits. This is the same table as fast_float and
+ * fast_double_parser use.
+ *
+ * ryuPow5Split and ryuPow5InvSplit are for the Ryu formatter: 5^i
+ * truncated to its top RYU_POW5_BITCOUNT bits, and
+ * 2^(bits(5^i) - 1 + RYU_POW5_INV_BITCOUNT) / 5^i + 1, exactly as in
+ * Ulf Adams' reference tables.
+ *
+ * All of it is done with a small arbitrary-precision integer so the
+ * table doesn't have to be pasted into the repository. */
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#define SMALLEST_POWER (-342)
+#define LARGEST_POWER  308
+
+#define RYU_POW5_BITCOUNT     125
+#define RYU_POW5_INV_BITCOUNT 125
+#define RYU_POW5_SPLIT        326
+#define RYU_POW5_INV_SPLIT    342
+
+// Enough 32-bit limbs for 2^(2 * 796 + 128).
+#define LIMBS 64
+
+typedef struct {
+    uint32_t limbs[LIMBS]; // Little-endian.
+} BigInt;
+
+static void setSmall(BigInt* n, uint32_t value) {
+    memset(n, 0, sizeof(*n));
+    n->limbs[0] = value;
+}
+
+static void mulSmall(BigInt* n, uint32_t factor) {
+    uint64_t carry = 0;
+    for (int i = 0; i < LIMBS; ++i) {
+        uint64_t product = (uint64_t)n->limbs[i] * factor + carry;
+        n->limbs[i] = (uint32_t)product;
+        carry = product >> 32;
+    }
+}
+
+static int bitLength(const BigInt* n) {
+    for (int i = LIMBS - 1; i >= 0; --i) {
+        if (n->limbs[i] != 0) {
+            return i * 32 + (32 - __builtin_clz(n->limbs[i]));
+        }
+    }
+    return 0;
+}
+
+static int getBit(const BigInt* n, int bit) {
+    return (n->limbs[bit / 32] >> (bit % 32)) & 1;
+}
+
+static void setBit(BigInt* n, int bit) {
+    n->limbs[bit / 32] |= 1u << (bit % 32);
+}
+
+static void shiftLeft1(BigInt* n) {
+    for (int i = LIMBS - 1; i > 0; --i) {
+        n->limbs[i] = (n->limbs[i] << 1) | (n->limbs[i - 1] >> 31);
+    }
+    n->limbs[0] <<= 1;
+}
+
+static int compare(const BigInt* a, const BigInt* b) {
+    for (int i = LIMBS - 1; i >= 0; --i) {
+        if (a->limbs[i] != b->limbs[i]) {
+            return a->limbs[i] < b->limbs[i] ? -1 : 1;
+        }
+    }
+    return 0;
+}
+
+static void subtract(BigInt* a, const BigInt* b) {
+    int64_t borrow = 0;
+    for (int i = 0; i < LIMBS; ++i) {
+        int64_t diff = (int64_t)a->limbs[i] - b->limbs[i] - borrow;
+        borrow = diff < 0;
+        a->limbs[i] = (uint32_t)(diff + (borrow ? (1ll << 32) : 0));
+    }
+}
+
+/* quotient = 2^exponent / divisor, by binary long division. */
+static void divPowerOfTwo(int exponent, const BigInt* divisor,
+                          BigInt* quotient) {
+    BigInt remainder;
+    setSmall(&remainder, 0);
+    setSmall(quotient, 0);
+
+    for (int bit = exponent; bit >= 0; --bit) {
+        shiftLeft1(&remainder);
+        if (bit == exponent) remainder.limbs[0] |= 1;
+        if (compare(&remainder, divisor) >= 0) {
+            subtract(&remainder, divisor);
+            setBit(quotient, bit);
+        }
+    }
+}
+
+/* The low 128 bits of n, as two 64-bit halves. */
+static void low128(const BigInt* n, uint64_t* hi, uint64_t* lo) {
+    *lo = (uint64_t)n->limbs[1] << 32 | n->limbs[0];
+    *hi = (uint64_t)n->limbs[3] << 32 | n->limbs[2];
+}
+
+static void shiftRight(BigInt* n, int bits) {
+    for (int i = 0; i < bits; ++i) {
+        for (int j = 0; j < LIMBS - 1; ++j) {
+            n->limbs[j] = (n->limbs[j] >> 1) | (n->limbs[j + 1] << 31);
+        }
+        n->limbs[LIMBS - 1] >>= 1;
+    }
+}
+
+static void addOne(BigInt* n) {
+    uint64_t carry = 1;
+    for (int i = 0; i < LIMBS && carry; ++i) {
+        uint64_t sum = (uint64_t)n->limbs[i] + carry;
+        n->limbs[i] = (uint32_t)sum;
+        carry = sum >> 32;
+    }
+}
+
+static void powerOfFive(BigInt* n, int exponent) {
+    setSmall(n, 1);
+    for (int i = 0; i < exponent; ++i) mulSmall(n, 5);
+}
+
+/* Ryu's tables store {low, high} halves. */
+static void printRyuTables() {
+    printf("#define RYU_POW5_BITCOUNT     %d\n", RYU_POW5_BITCOUNT);
+    printf("#define RYU_POW5_INV_BITCOUNT %d\n\n", RYU_POW5_INV_BITCOUNT);
+
+    printf("// {low 64 bits, high 64 bits} of 5^i, top %d bits.\n",
+           RYU_POW5_BITCOUNT);
+    printf("static const uint64_t ryuPow5Split[%d][2] = {\n",
+           RYU_POW5_SPLIT);
+    for (int i = 0; i < RYU_POW5_SPLIT; ++i) {
+        BigInt power;
+        powerOfFive(&power, i);
+        int length = bitLength(&power);
+        if (length > RYU_POW5_BITCOUNT) {
+            shiftRight(&power, length - RYU_POW5_BITCOUNT);
+        } else {
+            for (int j = length; j < RYU_POW5_BITCOUNT; ++j) {
+                shiftLeft1(&power);
+            }
+        }
+
+        uint64_t hi, lo;
+        low128(&power, &hi, &lo);
+        printf("    {0x%016llxull, 0x%016llxull}, // 5^%d\n",
+               (unsigned long long)lo, (unsigned long long)hi, i);
+    }
+    printf("};\n\n");
+
+    printf("// {low 64 bits, high 64 bits} of 2^k / 5^i + 1.\n");
+    printf("static const uint64_t ryuPow5InvSplit[%d][2] = {\n",
+           RYU_POW5_INV_SPLIT);
+    for (int i = 0; i < RYU_POW5_INV_SPLIT; ++i) {
+        BigInt power;
+        powerOfFive(&power, i);
+        int j = bitLength(&power) - 1 + RYU_POW5_INV_BITCOUNT;
+
+        BigInt inverse;
+        divPowerOfTwo(j, &power, &inverse);
+        addOne(&inverse);
+
+        uint64_t hi, lo;
+        low128(&inverse, &hi, &lo);
+        printf("    {0x%016llxull, 0x%016llxull}, // 5^-%d\n",
+               (unsigned long long)lo, (unsigned long long)hi, i);
+    }
+    printf("};\n\n");
+}
+
+/* The top 128 bits of n, as two 64-bit halves. */
+static void top128(const BigInt* n, uint64_t* hi, uint64_t* lo) {
+    int length = bitLength(n);
+    *hi = 0;
+    *lo = 0;
+    for (int i = 0; i < 128; ++i) {
+        int bit = length - 1 - i;
+        int value = bit >= 0 ? getBit(n, bit) : 0;
+        if (i < 64) {
+            *hi = (*hi << 1) | value;
+        } else {
+            *lo = (*lo << 1) | value;
+        }
+    }
+}
+
+int main() {
+    printf("/* Generated by tools/genpow5.c. Do not edit. */\n");
+    printf("#ifndef clox_pow5table_h\n");
+    printf("#define clox_pow5table_h\n\n");
+    printf("#define POW5_SMALLEST_POWER (%d)\n", SMALLEST_POWER);
+    printf("#define POW5_LARGEST_POWER  %d\n\n", LARGEST_POWER);
+    printf("// {high 64 bits, low 64 bits} of 5^q, normalised.\n");
+    printf("static const uint64_t pow5table[][2] = {\n");
+
+    for (int q = SMALLEST_POWER; q <= LARGEST_POWER; ++q) {
+        BigInt power;
+        powerOfFive(&power, q < 0 ? -q : q);
+
+        uint64_t hi, lo;
+        if (q >= 0) {
+            top128(&power, &hi, &lo);
+        } else {
+            // z = bits needed to hold 5^-q, as ceil(log2(5^-q)).
+            int z = bitLength(&power);
+            BigInt exact;
+            setSmall(&exact, 1);
+            for (int i = 0; i < z - 1; ++i) mulSmall(&exact, 2);
+            if (compare(&exact, &power) == 0) z--;
+
+            int b = q >= -27 ? z + 127 : 2 * z + 128;
+            BigInt quotient;
+            divPowerOfTwo(b, &power, &quotient);
+
+            // Round up, then keep the top 128 bits.
+            addOne(&quotient);
+            top128(&quotient, &hi, &lo);
+        }
+
+        printf("    {0x%016llxull, 0x%016llxull}, // 5^%d\n",
+               (unsigned long long)hi, (unsigned long long)lo, q);
+    }
+
+    printf("};\n\n");
+
+    printRyuTables();
+    printf("#endif\n");
+    return 0;
+}
@@ -0,0 +1,119 @@
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "intern.h"
+#include "memory.h"
+#include "trace.h"
+#include "vm.h"
+
+bool traceEnabled = false;
+
+static const char*     tracePath = NULL;
+static pthread_mutex_t traceLock = PTHREAD_MUTEX_INITIALIZER;
+
+// The events so far, already formatted, each ending in ",\n".
+static char*  events        = NULL;
+static size_t eventsLength   = 0;
+static size_t eventsCapacity = 0;
+
+// Trace viewers want small thread ids; number threads as they appear.
+static atomic_int     nextThreadId = 1;
+static _Thread_local int threadId   = 0;
+
+static int currentThreadId() {
+    if (threadId == 0) threadId = atomic_fetch_add(&nextThreadId, 1);
+    return threadId;
+}
+
+/* Microseconds on the monotonic clock, the unit trace events use. */
+double traceNow() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec * 1e6 + now.tv_nsec / 1e3;
+}
+
+static void addEvent(const char* format, ...)
+    __attribute__((format(printf, 1, 2)));
+
+static void addEvent(const char* format, ...) {
+    char event[512];
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(event, sizeof(event), format, args);
+    va_end(args);
+    if (length < 0) return;
+    if ((size_t)length >= sizeof(event)) length = sizeof(event) - 1;
+
+    // Events are stored with plain malloc so tracing doesn't show up
+    // in the heap counter.
+    pthread_mutex_lock(&traceLock);
+    if (eventsLength + length > eventsCapacity) {
+        while (eventsLength + length > eventsCapacity) {
+            eventsCapacity = eventsCapacity < 4096 ? 4096
+                                                   : eventsCapacity * 2;
+        }
+        events = realloc(events, eventsCapacity);
+        if (events == NULL) exit(1);
+    }
+    memcpy(events + eventsLength, event, length);
+    eventsLength += length;
+    pthread_mutex_unlock(&traceLock);
+}
+
+/* A complete ("X") event from `start` until now. `args` is the body of
+ * a JSON object, e.g. "\"capacity\":16", or NULL. */
+void traceSpan(const char* name, double start, const char* args) {
+    double now = traceNow();
+    addEvent("{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,"
+             "\"pid\":%d,\"tid\":%d,\"args\":{%s}},\n",
+             name, start, now - start, (int)getpid(), currentThreadId(),
+             args == NULL ? "" : args);
+}
+
+/* Counter ("C") events for the heap and the number of objects. */
+void traceCounters() {
+    double now = traceNow();
+    addEvent("{\"name\":\"heap\",\"ph\":\"C\",\"ts\":%.3f,\"pid\":%d,"
+             "\"args\":{\"bytes\":%lld}},\n",
+             now, (int)getpid(), (long long)bytesAllocated);
+    addEvent("{\"name\":\"objects\",\"ph\":\"C\",\"ts\":%.3f,\"pid\":%d,"
+             "\"args\":{\"vm\":%d,\"interned\":%d}},\n",
+             now, (int)getpid(), vm.objectCount, internCount());
+}
+
+static void writeTrace() {
+    FILE* file = fopen(tracePath, "w");
+    if (file == NULL) {
+        perror(tracePath);
+        return;
+    }
+
+    fprintf(file, "{\"traceEvents\":[\n");
+    fprintf(file, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,"
+                  "\"args\":{\"name\":\"clox\"}}",
+            (int)getpid());
+    if (eventsLength > 0) {
+        // Swap the last event's trailing ",\n" for the separator.
+        fputs(",\n", file);
+        fwrite(events, 1, eventsLength - 2, file);
+    }
+    fprintf(file, "\n],\"displayTimeUnit\":\"ms\"}\n");
+    fclose(file);
+
+    free(events);
+    events = NULL;
+    eventsLength = eventsCapacity = 0;
+}
+
+/* Record events from now on and write them to `path` at exit. */
+void startTrace(const char* path) {
+    tracePath    = path;
+    traceEnabled = true;
+    atexit(writeTrace);
+}
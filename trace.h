@@ -0,0 +1,23 @@
+#ifndef clox_trace_h
+#define clox_trace_h
+
+#include "common.h"
+
+/* A timeline of what the interpreter spent its time on (--trace-events),
+ * written as Chrome trace-event JSON for chrome://tracing or Perfetto.
+ *
+ * Spans cover compile(), each run of the bytecode, table resizes and
+ * intern table growth; counters sample heap bytes and object counts at
+ * the end of each span. Events are kept in memory and written out when
+ * the process exits.
+ *
+ * Call sites check `traceEnabled` before doing anything else, so with
+ * tracing off each costs one load and a branch. */
+extern bool traceEnabled;
+
+void   startTrace(const char* path);
+double traceNow();
+void   traceSpan(const char* name, double start, const char* args);
+void   traceCounters();
+
+#endif
@@ -1,46 +1,138 @@
 #include <stdarg.h>
 #include <stdio.h>
 #include <string.h>
+#include <time.h>
 
 #include "common.h"
 #include "compiler.h"
 #include "debug.h"
+#include "intern.h"
 #include "object.h"
 #include "memory.h"
+#include "trace.h"
 #include "vm.h"
 
-// Global singleton VirtualMachine object.
-VM vm;
+// Each thread gets its own VirtualMachine object.
+_Thread_local VM vm;
+
+/* Seconds since an arbitrary fixed point, from the monotonic clock,
+ * for timing code from inside a script. */
+static Value clockNative(int argCount, Value* args) {
+    (void)argCount;
+    (void)args;
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return NUMBER_VAL((double)now.tv_sec + now.tv_nsec / 1e9);
+}
 
 static void resetStack() {
-    vm.stackTop = vm.stack;
+    vm.stackTop   = vm.stack;
+    vm.frameCount = 0;
 }
 
 static void runtimeError(const char* format, ...) {
+    // Keep anything printed before the error ahead of it.
+    flushOutput(&vm.output);
+
     va_list args;
     va_start(args, format);
-    vfprintf(stderr, format, args);
+    vfprintf(vm.errors, format, args);
     va_end(args);
-    fputs("\n", stderr);
+    fputs("\n", vm.errors);
 
-    size_t instruction = vm.ip - vm.chunk->code - 1;
-    int line = vm.chunk->lines[instruction];
-    fprintf(stderr, "[line %d] in script\n", line);
+    // Innermost call first. Only callers have their ip saved in the
+    // frame; the running one's is in vm.ip.
+    for (int i = vm.frameCount - 1; i >= 0; i--) {
+        CallFrame*   frame    = &vm.frames[i];
+        ObjFunction* function = frame->function;
+        uint8_t*     ip       = i == vm.frameCount - 1 ? vm.ip : frame->ip;
+
+        size_t instruction = ip - function->chunk.code - 1;
+        fprintf(vm.errors, "[line %d] in ",
+                function->chunk.lines[instruction]);
+        if (function->name == NULL) {
+            fprintf(vm.errors, "script\n");
+        } else {
+            fprintf(vm.errors, "%s()\n", function->name->chars);
+        }
+    }
 
     resetStack();
 }
 
+static void defineNative(const char* name, NativeFn function, int arity) {
+    ObjString* nameString = copyString(name, (int)strlen(name));
+    tableSet(&vm.globals, nameString,
+             OBJ_VAL(newNative(function, arity, nameString)));
+}
+
 void initVM() {
+    vm.stack = ALLOCATE(Value, STACK_MAX);
     resetStack();
-    vm.objects = NULL;
+    vm.objects     = NULL;
+    vm.objectCount = 0;
     initTable(&vm.globals);
     initTable(&vm.strings);
+    initOutput(&vm.output);
+    vm.errors           = stderr;
+    vm.reportHotLoops   = false;
+    vm.pipelineScanner  = false;
+    vm.instructionCount = 0;
+    vm.budget           = UINT64_MAX;
+
+    defineNative("clock", clockNative, 0);
+}
+
+/* Give back the VM's references to interned strings. */
+static void releaseStrings() {
+    bool incremental = vm.strings.incremental;
+    tableEachKey(&vm.strings, internRelease);
+    freeTable(&vm.strings);
+    initTable(&vm.strings);
+    vm.strings.incremental = incremental;
+}
+
+/* Forget everything a script left behind (globals, objects, strings,
+ * anything on the stack) so the next one starts as if on a fresh VM.
+ * Settings are kept. */
+void resetVM() {
+    resetVMKeepingStrings(0);
+}
+
+/* Like resetVM(), but keep the VM's references to interned strings
+ * while it holds no more than `maxStrings` of them. The next script
+ * then finds the names and literals it shares with earlier ones in
+ * vm.strings, without going to the intern table. */
+void resetVMKeepingStrings(int maxStrings) {
+    resetStack();
+    freeObjects();
+    vm.objects     = NULL;
+    vm.objectCount = 0;
+    if (vm.strings.count > maxStrings) releaseStrings();
+    resetGlobals();
+}
+
+/* Drop every global the scripts defined, leaving just the natives. */
+void resetGlobals() {
+    bool incremental = vm.globals.incremental;
+    bool trackStats  = vm.globals.stats != NULL;
+    freeTable(&vm.globals);
+    initTable(&vm.globals);
+    vm.globals.incremental = incremental;
+    if (trackStats) tableTrackStats(&vm.globals);
+
+    defineNative("clock", clockNative, 0);
 }
 
 void freeVM() {
+    // The profiler mustn't walk frames whose functions are being freed.
+    vm.frameCount = 0;
     freeObjects();
     freeTable(&vm.globals);
-    freeTable(&vm.strings);
+    releaseStrings();
+    freeOutput(&vm.output);
+    FREE_ARRAY(Value, vm.stack, STACK_MAX);
 }
 
 void push(Value value) {
@@ -64,6 +156,98 @@ static bool isFalsey(Value value) {
     return IS_NIL(value) || (IS_BOOL(value) && !AS_BOOL(value));
 }
 
+/* Type feedback for the instruction being executed. */
+static inline uint8_t* currentFeedback() {
+    return &vm.chunk->feedback[vm.ip - vm.chunk->code - 1];
+}
+
+/* Rewrite the current instruction to its number-only form, unless
+ * it keeps getting deoptimised. */
+static inline void quicken(OpCode quickened) {
+    uint8_t* feedback = currentFeedback();
+    *feedback |= FEEDBACK_NUMBERS;
+    if (FEEDBACK_DEOPTS(*feedback) < FEEDBACK_MAX_DEOPTS) {
+        vm.ip[-1] = quickened;
+    }
+}
+
+/* A quickened instruction saw something other than two numbers: put
+ * the generic instruction back and step back so it runs next. */
+static inline void deoptimize(OpCode generic) {
+    uint8_t* feedback = currentFeedback();
+    if (FEEDBACK_DEOPTS(*feedback) < FEEDBACK_MAX_DEOPTS) {
+        *feedback += 1 << FEEDBACK_DEOPT_SHIFT;
+    }
+    vm.ip[-1] = generic;
+    vm.ip--;
+}
+
+/* Start running `function`. Its arguments are already on the stack, so
+ * the new frame's window just starts at the callee below them. */
+static bool call(ObjFunction* function, int argCount) {
+    if (argCount != function->arity) {
+        runtimeError("Expected %d arguments but got %d.",
+                     function->arity, argCount);
+        return false;
+    }
+
+    if (vm.frameCount == FRAMES_MAX) {
+        runtimeError("Stack overflow.");
+        return false;
+    }
+
+    if (vm.frameCount > 0) vm.frames[vm.frameCount - 1].ip = vm.ip;
+
+    CallFrame* frame = &vm.frames[vm.frameCount++];
+    frame->function  = function;
+    frame->slots     = vm.stackTop - argCount - 1;
+
+    vm.chunk = &function->chunk;
+    vm.ip    = function->chunk.code;
+    return true;
+}
+
+/* Natives run straight away, reading their arguments in place. */
+static bool callNative(ObjNative* native, int argCount) {
+    if (argCount != native->arity) {
+        runtimeError("Expected %d arguments but got %d.",
+                     native->arity, argCount);
+        return false;
+    }
+
+    Value result = native->function(argCount, vm.stackTop - argCount);
+    vm.stackTop -= argCount + 1;
+    push(result);
+    return true;
+}
+
+static bool callValue(Value callee, int argCount) {
+    if (IS_OBJ(callee)) {
+        switch (OBJ_TYPE(callee)) {
+            case OBJ_CLASS: {
+                // Classes have no initializers yet.
+                if (argCount != 0) {
+                    runtimeError("Expected 0 arguments but got %d.",
+                                 argCount);
+                    return false;
+                }
+                ObjClass* klass = AS_CLASS(callee);
+                vm.stackTop[-1] = OBJ_VAL(newInstance(klass));
+                return true;
+            }
+            case OBJ_FUNCTION:
+                return call(AS_FUNCTION(callee), argCount);
+            case OBJ_NATIVE:
+                return callNative(AS_NATIVE(callee), argCount);
+            default:
+                break; // Non-callable object type.
+        }
+    }
+
+    runtimeError("Can only call functions and classes.");
+    return false;
+}
+
 static void concatenate() {
     // `b` is popped first, since stacks are LIFO
     ObjString* b = AS_STRING(pop());
@@ -84,6 +268,18 @@ static void concatenate() {
 }
 
 static InterpretResult run() {
+    CallFrame* frame = &vm.frames[vm.frameCount - 1];
+
+    // Counted in a local, which can live in a register, and added to
+    // the VM's total on the way out.
+    uint64_t executed = 0;
+
+#define RETURN(result) \
+    do { \
+        vm.instructionCount += executed; \
+        return result;                   \
+    } while (false)
+
 // dereferences the current instruction pointer
 // and advances to the next instruction.
 #define READ_BYTE() (*vm.ip++)
@@ -94,21 +290,48 @@ static InterpretResult run() {
 
 #define READ_STRING() AS_STRING(READ_CONSTANT())
 
+// The inline cache named by a property instruction's operand.
+#define READ_CACHE() \
+    (vm.ip += 2, &vm.chunk->caches[(vm.ip[-2] << 8) | vm.ip[-1]])
+
+// Reads a two-byte, big-endian jump offset.
+#define READ_SHORT() \
+    (vm.ip += 2, (uint16_t)((vm.ip[-2] << 8) | vm.ip[-1]))
+
 // Perform a binary operation such as addition or multiplication
-// on the two values at the top of the stack.
-#define BINARY_OP(valueType, op) \
+// on the two values at the top of the stack, quickening the
+// instruction to `quickened` for next time.
+#define BINARY_OP(valueType, op, quickened) \
     do { \
         if (!IS_NUMBER(peek(0)) || !IS_NUMBER(peek(1))) { \
+            *currentFeedback() |= FEEDBACK_OTHER;         \
             runtimeError("Operands must be numbers.");    \
-            return INTERPRET_RUNTIME_ERROR;               \
+            RETURN(INTERPRET_RUNTIME_ERROR);               \
         } \
+        quicken(quickened);          \
         double b = AS_NUMBER(pop()); \
         double a = AS_NUMBER(pop()); \
         push(valueType(a op b));     \
     } while (false)
 
+// The quickened form: one combined type check, then the result
+// overwrites the left operand in place.
+#define NUMBER_OP(valueType, op, generic) \
+    do { \
+        Value b = vm.stackTop[-1]; \
+        Value a = vm.stackTop[-2]; \
+        if (!IS_NUMBER(a) | !IS_NUMBER(b)) { \
+            deoptimize(generic);             \
+        } else {                             \
+            vm.stackTop[-2] = valueType(AS_NUMBER(a) op AS_NUMBER(b)); \
+            vm.stackTop--;                   \
+        }                                    \
+    } while (false)
+
     for (;;) {
 #ifdef DEBUG_TRACE_EXECUTION
+        // The trace goes through stdio; keep it in order with prints.
+        flushOutput(&vm.output);
         printf("        ");
         for (Value* slot = vm.stack; slot < vm.stackTop; slot++) {
             printf("[ ");
@@ -121,13 +344,12 @@ static InterpretResult run() {
         disassembleInstruction(vm.chunk,
                                (int)(vm.ip - vm.chunk->code));
 #endif
+        executed++;
         uint8_t instruction;
         switch (instruction = READ_BYTE()) {
             case OP_CONSTANT: {
                 Value constant = READ_CONSTANT();
                 push(constant);
-                printValue(constant);
-                printf("\n");
                 break;
             }
 
@@ -136,14 +358,27 @@ static InterpretResult run() {
             case OP_TRUE:  push(BOOL_VAL(true));  break;
             case OP_FALSE: push(BOOL_VAL(false)); break;
             case OP_POP:   pop();                 break;
+            case OP_POPN:  vm.stackTop -= READ_BYTE(); break;
+            case OP_GET_LOCAL: {
+                // Locals live in stack slots: no lookup needed.
+                uint8_t slot = READ_BYTE();
+                push(frame->slots[slot]);
+                break;
+            }
+            case OP_SET_LOCAL: {
+                // Assignment is an expression, so leave the value on
+                // the stack.
+                uint8_t slot = READ_BYTE();
+                frame->slots[slot] = peek(0);
+                break;
+            }
             case OP_GET_GLOBAL: {
                 // Read a global and push it's value onto the stack
                 ObjString* name = READ_STRING();
-                printf(name);
                 Value value;
                 if (!tableGet(&vm.globals, name, &value)) {
                     runtimeError("Undefined variable '%s'.", name->chars);
-                    return INTERPRET_RUNTIME_ERROR;
+                    RETURN(INTERPRET_RUNTIME_ERROR);
                 }
                 push(value);
                 break;
@@ -160,11 +395,77 @@ static InterpretResult run() {
                 //
                 // ??? If we instead `pop` the value immediately, it may
                 // no longer be referenced on the stack and thus deleted.
-                bool success = tableSet(&vm.globals, name, peek(0));
-                printf("ADDED TO GLOBALS ? %i", success);
+                tableSet(&vm.globals, name, peek(0));
                 pop();
                 break;
             }
+            case OP_SET_GLOBAL: {
+                ObjString* name = READ_STRING();
+                // tableSet returns true for a new key: assigning to an
+                // undefined global is an error, so take it back out.
+                if (tableSet(&vm.globals, name, peek(0))) {
+                    tableDelete(&vm.globals, name);
+                    runtimeError("Undefined variable '%s'.", name->chars);
+                    RETURN(INTERPRET_RUNTIME_ERROR);
+                }
+                break;
+            }
+            case OP_GET_PROPERTY: {
+                ObjString*     name  = READ_STRING();
+                PropertyCache* cache = READ_CACHE();
+                if (!IS_INSTANCE(peek(0))) {
+                    runtimeError("Only instances have properties.");
+                    RETURN(INTERPRET_RUNTIME_ERROR);
+                }
+                ObjInstance* instance = AS_INSTANCE(peek(0));
+
+                // Same shape as last time: the field is in the same slot.
+                if (instance->shape == cache->shape) {
+                    vm.stackTop[-1] = instance->fields[cache->slot];
+                    break;
+                }
+
+                int slot = shapeFind(instance->shape, name);
+                if (slot == -1) {
+                    runtimeError("Undefined property '%s'.", name->chars);
+                    RETURN(INTERPRET_RUNTIME_ERROR);
+                }
+                cache->shape      = instance->shape;
+                cache->transition = NULL;
+                cache->slot       = slot;
+                vm.stackTop[-1] = instance->fields[slot];
+                break;
+            }
+            case OP_SET_PROPERTY: {
+                ObjString*     name  = READ_STRING();
+                PropertyCache* cache = READ_CACHE();
+                if (!IS_INSTANCE(peek(1))) {
+                    runtimeError("Only instances have fields.");
+                    RETURN(INTERPRET_RUNTIME_ERROR);
+                }
+                ObjInstance* instance = AS_INSTANCE(peek(1));
+
+                if (instance->shape != cache->shape) {
+                    cache->shape      = instance->shape;
+                    cache->transition = NULL;
+                    cache->slot       = shapeFind(instance->shape, name);
+                    if (cache->slot == -1) {
+                        // A new field: it goes in the next free slot.
+                        cache->transition = shapeAdd(instance->shape, name);
+                        cache->slot       = instance->shape->slotCount;
+                    }
+                }
+
+                if (cache->transition != NULL) {
+                    instanceSetShape(instance, cache->transition);
+                }
+                instance->fields[cache->slot] = peek(0);
+
+                // Leave the assigned value as the expression's result.
+                Value value = pop();
+                vm.stackTop[-1] = value;
+                break;
+            }
             case OP_EQUAL: {
                 Value b = pop();
                 Value a = pop();
@@ -172,26 +473,35 @@ static InterpretResult run() {
                 break;
             }
             /* Arithmetic operations */
-            case OP_GREATER:  BINARY_OP(BOOL_VAL, >);   break;
-            case OP_LESS:     BINARY_OP(BOOL_VAL, <);   break;
+            case OP_GREATER:  BINARY_OP(BOOL_VAL, >, OP_GREATER_NUM); break;
+            case OP_LESS:     BINARY_OP(BOOL_VAL, <, OP_LESS_NUM);    break;
             case OP_ADD: {
-                if (IS_STRING(peek(0)) && IS_NUMBER(peek(1))) {
-                    concatenate();
-                } else if (IS_NUMBER(peek(0)) && IS_NUMBER(peek(1))) {
+                if (IS_NUMBER(peek(0)) && IS_NUMBER(peek(1))) {
+                    quicken(OP_ADD_NUM);
                     double b = AS_NUMBER(pop());
                     double a = AS_NUMBER(pop());
                     push(NUMBER_VAL(a + b));
+                } else if (IS_STRING(peek(0)) && IS_STRING(peek(1))) {
+                    *currentFeedback() |= FEEDBACK_STRINGS;
+                    concatenate();
                 } else {
+                    *currentFeedback() |= FEEDBACK_OTHER;
                     runtimeError(
                         "Operands must be two numbers or two strings."
                     );
-                    return INTERPRET_RUNTIME_ERROR;
+                    RETURN(INTERPRET_RUNTIME_ERROR);
                 }
                 break;
             }
-            case OP_SUBTRACT: BINARY_OP(NUMBER_VAL, -); break;
-            case OP_MULTIPLY: BINARY_OP(NUMBER_VAL, *); break;
-            case OP_DIVIDE:   BINARY_OP(NUMBER_VAL, /); break;
+            case OP_SUBTRACT: BINARY_OP(NUMBER_VAL, -, OP_SUBTRACT_NUM); break;
+            case OP_MULTIPLY: BINARY_OP(NUMBER_VAL, *, OP_MULTIPLY_NUM); break;
+            case OP_DIVIDE:   BINARY_OP(NUMBER_VAL, /, OP_DIVIDE_NUM);   break;
+            case OP_GREATER_NUM:  NUMBER_OP(BOOL_VAL, >, OP_GREATER);    break;
+            case OP_LESS_NUM:     NUMBER_OP(BOOL_VAL, <, OP_LESS);       break;
+            case OP_ADD_NUM:      NUMBER_OP(NUMBER_VAL, +, OP_ADD);      break;
+            case OP_SUBTRACT_NUM: NUMBER_OP(NUMBER_VAL, -, OP_SUBTRACT); break;
+            case OP_MULTIPLY_NUM: NUMBER_OP(NUMBER_VAL, *, OP_MULTIPLY); break;
+            case OP_DIVIDE_NUM:   NUMBER_OP(NUMBER_VAL, /, OP_DIVIDE);   break;
             case OP_NOT: {
                 push(BOOL_VAL(isFalsey(pop())));
                 break;
@@ -199,20 +509,67 @@ static InterpretResult run() {
             case OP_NEGATE: {
                 if (!IS_NUMBER(peek(0))) {
                     runtimeError("Operand must be a number.");
-                    return INTERPRET_RUNTIME_ERROR;
+                    RETURN(INTERPRET_RUNTIME_ERROR);
                 }
 
                 push(NUMBER_VAL(-AS_NUMBER(pop())));
                 break;
             }
             case OP_PRINT: {
-                printValue(pop());
-                printf("\n");
+                printValueLine(&vm.output, pop());
+                break;
+            }
+            case OP_JUMP: {
+                uint16_t offset = READ_SHORT();
+                vm.ip += offset;
+                break;
+            }
+            case OP_JUMP_IF_FALSE: {
+                // The condition is left for the compiler to pop.
+                uint16_t offset = READ_SHORT();
+                if (isFalsey(peek(0))) vm.ip += offset;
                 break;
             }
+            case OP_LOOP: {
+                uint16_t offset = READ_SHORT();
+                uint16_t loop   = READ_SHORT();
+                if (loop != LOOP_UNCOUNTED) vm.chunk->loops[loop].count++;
+                vm.ip -= offset + 2;
+                if (executed >= vm.budget) RETURN(INTERPRET_YIELD);
+                break;
+            }
+            case OP_CALL: {
+                int argCount = READ_BYTE();
+                if (!callValue(peek(argCount), argCount)) {
+                    RETURN(INTERPRET_RUNTIME_ERROR);
+                }
+                frame = &vm.frames[vm.frameCount - 1];
+                if (executed >= vm.budget) RETURN(INTERPRET_YIELD);
+                break;
+            }
+            case OP_CLASS:
+                push(OBJ_VAL(newClass(READ_STRING())));
+                break;
             case OP_RETURN: {
-                // Exit the interpreter.
-                return INTERPRET_OK;
+                Value result = pop();
+                vm.frameCount--;
+                if (vm.frameCount == 0) {
+                    // Returning from the script: exit the interpreter,
+                    // leaving the result just past the top of the
+                    // stack for callFunction().
+                    vm.stackTop  = frame->slots;
+                    *vm.stackTop = result;
+                    RETURN(INTERPRET_OK);
+                }
+
+                // Discard the callee's window and hand back the result.
+                vm.stackTop = frame->slots;
+                push(result);
+
+                frame    = &vm.frames[vm.frameCount - 1];
+                vm.chunk = &frame->function->chunk;
+                vm.ip    = frame->ip;
+                break;
             }
         }
     }
@@ -220,24 +577,122 @@ static InterpretResult run() {
 #undef READ_BYTE
 #undef READ_CONSTANT    
 #undef READ_STRING
+#undef READ_SHORT
+#undef READ_CACHE
 #undef BINARY_OP
+#undef NUMBER_OP
+#undef RETURN
 }
 
 
 InterpretResult interpret(const char* source) {
-    Chunk chunk;
-    initChunk(&chunk);
+    ObjFunction* function = compile(source);
+    if (function == NULL) return INTERPRET_COMPILE_ERROR;
+
+    return interpretFunction(function);
+}
+
+/* Run an already compiled top-level script. */
+InterpretResult interpretFunction(ObjFunction* function) {
+    loadFunction(function);
+    return resumeVM();
+}
+
+/* Set up `function` as the top-level script, ready for resumeVM(). */
+void loadFunction(ObjFunction* function) {
+    // The script sits in slot 0 of its own frame, like any callee.
+    push(OBJ_VAL(function));
+    call(function, 0);
+}
 
-    if (!compile(source, &chunk)) {
-        freeChunk(&chunk);
-        return INTERPRET_COMPILE_ERROR;
+/* Call `function` with `args` on an idle VM and wait for its result.
+ *
+ * This is the fast path for evaluating the same code over and over
+ * (see embed.h): the frame is set up in place and run() entered
+ * directly, without output flushing, tracing or hot loop reports. */
+InterpretResult callFunction(ObjFunction* function, const Value* args,
+                             Value* result) {
+    // As call() does, plus a check that the frame's window (at most
+    // UINT8_COUNT slots: the callee, its arguments and locals) fits.
+    if (vm.frameCount == FRAMES_MAX ||
+            vm.stackTop + UINT8_COUNT > vm.stack + STACK_MAX) {
+        runtimeError("Stack overflow.");
+        return INTERPRET_RUNTIME_ERROR;
     }
 
-    vm.chunk = &chunk;
-    vm.ip    = vm.chunk->code;
+    Value* slots = vm.stackTop;
+    slots[0] = OBJ_VAL(function);
+    for (int i = 0; i < function->arity; i++) slots[i + 1] = args[i];
+    vm.stackTop = slots + function->arity + 1;
 
+    CallFrame* frame = &vm.frames[vm.frameCount++];
+    frame->function  = function;
+    frame->slots     = slots;
+    vm.chunk = &function->chunk;
+    vm.ip    = function->chunk.code;
+
+    InterpretResult status = run();
+    if (status == INTERPRET_OK) *result = *vm.stackTop;
+    return status;
+}
+
+/* Run the loaded script until it finishes or, having used up
+ * vm.budget instructions, yields; after INTERPRET_YIELD, calling this
+ * again carries on from where it stopped. */
+InterpretResult resumeVM() {
+    double start = traceEnabled ? traceNow() : 0;
     InterpretResult result = run();
+    if (traceEnabled) {
+        traceSpan("run", start, NULL);
+        traceCounters();
+    }
+    if (result == INTERPRET_YIELD) return result;
+
+    flushOutput(&vm.output);
+    if (vm.reportHotLoops) printHotLoops(vm.objects);
+    return result;
+}
+
+/* Compile and run `source` one top-level declaration at a time.
+ *
+ * Only one declaration's bytecode exists at once, so memory use
+ * doesn't grow with the length of the script, and the first
+ * statement runs before the rest has even been scanned. Because
+ * of that, a compile error only stops the declarations after it.
+ *
+ * With --hot-loops each declaration gets a script function of its
+ * own instead, so its loop counters are still there for the report. */
+InterpretResult interpretStream(const char* source) {
+    ObjFunction* script = newFunction();
+    beginCompileStream(source);
+
+    InterpretResult result = INTERPRET_OK;
+    for (;;) {
+        if (vm.reportHotLoops) {
+            script = newFunction();
+        } else {
+            resetChunk(&script->chunk);
+        }
+
+        CompileStep step = compileNext(script);
+        if (step == COMPILE_STEP_END) break;
+        if (step == COMPILE_STEP_ERROR) {
+            // Keep compiling to report any further errors.
+            result = INTERPRET_COMPILE_ERROR;
+            continue;
+        }
+        if (result != INTERPRET_OK) continue;
+
+        push(OBJ_VAL(script));
+        call(script, 0);
+
+        double start = traceEnabled ? traceNow() : 0;
+        result = run();
+        if (traceEnabled) traceSpan("run", start, NULL);
+        if (result == INTERPRET_RUNTIME_ERROR) break;
+    }
+    flushOutput(&vm.output);
+    if (vm.reportHotLoops) printHotLoops(vm.objects);
 
-    freeChunk(&chunk);
-    return INTERPRET_OK;
+    return result;
 }
\ No newline at end of file
@@ -2,39 +2,82 @@
 #define clox_vm_h
 
 #include "chunk.h"
+#include "object.h"
+#include "output.h"
 #include "value.h"
 #include "table.h"
 
-#define STACK_MAX 256
+#define FRAMES_MAX 64
+#define STACK_MAX  (FRAMES_MAX * UINT8_COUNT)
 
+/* An ongoing function call. `slots` is the callee's window into the
+ * VM stack: slot 0 holds the function itself and the arguments follow
+ * it, right where the caller pushed them. */
 typedef struct {
+    ObjFunction* function;
+    uint8_t*     ip; // Where to resume once a call from here returns.
+    Value*       slots;
+} CallFrame;
+
+typedef struct {
+    // The running frame's chunk and instruction pointer. These are
+    // kept here rather than read through the frame on every dispatch,
+    // and saved to the frame when it makes a call.
     Chunk*   chunk;
     uint8_t* ip;
     // IP: instruction pointer - points to the current instruction.
-    
-    Value  stack[STACK_MAX];
+
+    CallFrame frames[FRAMES_MAX];
+    int       frameCount;
+
+    Value* stack; // STACK_MAX slots.
     Value* stackTop;
     /* Pointer to the next empty slot at the top of the stack.
     It's quicker to simply dereference the pointer
     than to keep computing it using an offset.*/
     
     Table globals;
+    // Strings are interned process-wide, see intern.h. These are the
+    // ones this VM holds a reference to, looked up here first.
     Table strings;
 
+    Output output; // Where `print` goes.
+    FILE*  errors; // Where compile and runtime errors go.
+
+    bool reportHotLoops;  // Print loop counters after running.
+    bool pipelineScanner; // Compile with the scanner on its own thread.
+
+    uint64_t instructionCount; // Instructions run so far, in total.
+    // How many instructions run() may execute before it yields, which
+    // it checks at loop back-edges and calls. UINT64_MAX never yields.
+    uint64_t budget;
+
     Obj* objects;
+    int  objectCount; // How many are on `objects`.
 } VM;
 
 typedef enum {
     INTERPRET_OK,
     INTERPRET_COMPILE_ERROR,
     INTERPRET_RUNTIME_ERROR,
+    INTERPRET_YIELD, // Out of budget; resumeVM() to carry on.
 } InterpretResult;
 
-extern VM vm;
+// One VM per thread.
+extern _Thread_local VM vm;
 
 void initVM();
 void freeVM();
+void resetVM();
+void resetVMKeepingStrings(int maxStrings);
+void resetGlobals();
 InterpretResult interpret(const char* source);
+InterpretResult interpretFunction(ObjFunction* function);
+void            loadFunction(ObjFunction* function);
+InterpretResult resumeVM();
+InterpretResult callFunction(ObjFunction* function, const Value* args,
+                             Value* result);
+InterpretResult interpretStream(const char* source);
 
 void  push(Value value);
 Value pop();
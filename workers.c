@@ -0,0 +1,212 @@
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "memory.h"
+#include "table.h"
+#include "vm.h"
+#include "workers.h"
+
+/* `input` as a Lox value: a number if all of it is one, else a string. */
+static Value inputValue(const char* input) {
+    char*  end;
+    double number = strtod(input, &end);
+    if (end != input && *end == '\0') return NUMBER_VAL(number);
+    return OBJ_VAL(copyString(input, (int)strlen(input)));
+}
+
+/* Run `script` once for each of inputs[start..end), in a worker. */
+static int runSlice(ObjFunction* script, const char** inputs,
+                    int start, int end, int outFd, int errFd) {
+    vm.output.file = fdopen(outFd, "w");
+    vm.errors      = fdopen(errFd, "w");
+    if (vm.output.file == NULL || vm.errors == NULL) return 70;
+
+    ObjString* name   = copyString("input", 5);
+    int        status = 0;
+    for (int i = start; i < end; i++) {
+        resetGlobals();
+        tableSet(&vm.globals, name, inputValue(inputs[i]));
+        if (interpretFunction(script) != INTERPRET_OK) status = 76;
+    }
+
+    fclose(vm.output.file);
+    fclose(vm.errors);
+    return status;
+}
+
+/* What one worker has sent that can't be written out yet. */
+typedef struct {
+    pid_t pid;
+    int   fds[2];     // Its stdout and stderr pipes; -1 once closed.
+    char* held[2];
+    int   heldCount[2];
+    int   heldCapacity[2];
+} Worker;
+
+static void writeAll(int fd, const char* bytes, size_t length) {
+    while (length > 0) {
+        ssize_t wrote = write(fd, bytes, length);
+        if (wrote < 0 && errno == EINTR) continue;
+        if (wrote <= 0) return;
+        bytes  += wrote;
+        length -= (size_t)wrote;
+    }
+}
+
+static void hold(Worker* worker, int stream, const char* bytes,
+                 int length) {
+    int count = worker->heldCount[stream];
+    if (count + length > worker->heldCapacity[stream]) {
+        int oldCapacity = worker->heldCapacity[stream];
+        int capacity    = oldCapacity;
+        while (capacity < count + length) capacity = GROW_CAPACITY(capacity);
+        worker->held[stream] = GROW_ARRAY(char, worker->held[stream],
+                                          oldCapacity, capacity);
+        worker->heldCapacity[stream] = capacity;
+    }
+    memcpy(worker->held[stream] + count, bytes, length);
+    worker->heldCount[stream] += length;
+}
+
+/* Write out and free what `worker` sent while it wasn't its turn. */
+static void release(Worker* worker) {
+    for (int stream = 0; stream < 2; stream++) {
+        writeAll(stream == 0 ? STDOUT_FILENO : STDERR_FILENO,
+                 worker->held[stream], worker->heldCount[stream]);
+        FREE_ARRAY(char, worker->held[stream],
+                   worker->heldCapacity[stream]);
+        worker->held[stream] = NULL;
+        worker->heldCount[stream] = worker->heldCapacity[stream] = 0;
+    }
+}
+
+static bool finished(Worker* worker) {
+    return worker->fds[0] < 0 && worker->fds[1] < 0;
+}
+
+/* Read the workers' output until they've all closed their pipes,
+ * writing it out in worker order. */
+static void collect(Worker* workers, int count) {
+    struct pollfd* polls = ALLOCATE(struct pollfd, count * 2);
+    int current = 0;
+    char buffer[65536];
+
+    while (current < count) {
+        for (int i = 0; i < count; i++) {
+            for (int stream = 0; stream < 2; stream++) {
+                polls[i * 2 + stream].fd     = workers[i].fds[stream];
+                polls[i * 2 + stream].events = POLLIN;
+            }
+        }
+        if (poll(polls, count * 2, -1) < 0) {
+            if (errno == EINTR) continue;
+            perror("poll");
+            break;
+        }
+
+        for (int i = 0; i < count * 2; i++) {
+            if (polls[i].fd < 0 || polls[i].revents == 0) continue;
+            Worker* worker = &workers[i / 2];
+            int     stream = i % 2;
+
+            ssize_t got = read(polls[i].fd, buffer, sizeof(buffer));
+            if (got < 0 && errno == EINTR) continue;
+            if (got <= 0) {
+                close(worker->fds[stream]);
+                worker->fds[stream] = -1;
+            } else if (worker == &workers[current]) {
+                writeAll(stream == 0 ? STDOUT_FILENO : STDERR_FILENO,
+                         buffer, (size_t)got);
+            } else {
+                hold(worker, stream, buffer, (int)got);
+            }
+        }
+
+        // Once the current worker is done, the next one's turn starts
+        // with whatever it has sent so far.
+        while (current < count && finished(&workers[current])) {
+            current++;
+            if (current < count) release(&workers[current]);
+        }
+    }
+
+    FREE_ARRAY(struct pollfd, polls, count * 2);
+}
+
+/* Fork `workers` processes to run `script` over `inputs` and wait for
+ * them. Returns 0 if every input ran without error, otherwise the
+ * first failing worker's exit code. */
+int runWorkers(ObjFunction* script, const char** inputs, int inputCount,
+               int workers) {
+    if (workers > inputCount) workers = inputCount;
+
+    // Anything still buffered would be written once by every worker.
+    flushOutput(&vm.output);
+    fflush(stdout);
+    fflush(stderr);
+
+    Worker* pool = ALLOCATE(Worker, workers);
+    memset(pool, 0, sizeof(Worker) * workers);
+    int started = 0;
+
+    for (; started < workers; started++) {
+        int outPipe[2], errPipe[2];
+        if (pipe(outPipe) != 0) {
+            perror("pipe");
+            break;
+        }
+        if (pipe(errPipe) != 0) {
+            perror("pipe");
+            close(outPipe[0]);
+            close(outPipe[1]);
+            break;
+        }
+
+        int start = (int)((int64_t)inputCount * started / workers);
+        int end   = (int)((int64_t)inputCount * (started + 1) / workers);
+
+        pid_t pid = fork();
+        if (pid < 0) {
+            perror("fork");
+            close(outPipe[0]); close(outPipe[1]);
+            close(errPipe[0]); close(errPipe[1]);
+            break;
+        }
+        if (pid == 0) {
+            // Don't hold the earlier workers' pipes open.
+            for (int i = 0; i < started; i++) {
+                close(pool[i].fds[0]);
+                close(pool[i].fds[1]);
+            }
+            close(outPipe[0]);
+            close(errPipe[0]);
+            _exit(runSlice(script, inputs, start, end,
+                           outPipe[1], errPipe[1]));
+        }
+
+        close(outPipe[1]);
+        close(errPipe[1]);
+        pool[started].pid    = pid;
+        pool[started].fds[0] = outPipe[0];
+        pool[started].fds[1] = errPipe[0];
+    }
+
+    collect(pool, started);
+
+    int status = started < workers ? 71 : 0;
+    for (int i = 0; i < started; i++) {
+        int exitStatus;
+        while (waitpid(pool[i].pid, &exitStatus, 0) < 0 && errno == EINTR);
+
+        int code = WIFEXITED(exitStatus) ? WEXITSTATUS(exitStatus) : 70;
+        if (status == 0) status = code;
+    }
+
+    FREE_ARRAY(Worker, pool, workers);
+    return status;
+}
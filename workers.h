@@ -0,0 +1,27 @@
+#ifndef clox_workers_h
+#define clox_workers_h
+
+#include "common.h"
+#include "object.h"
+
+/* Running one compiled script over many inputs on a pool of forked
+ * worker processes (--workers).
+ *
+ * The script is compiled once, before forking, so no worker compiles
+ * it again. Its chunks don't stay shared, though: the VM writes to
+ * them as it runs (quickening, type feedback, loop counts, inline
+ * caches), so each worker ends up with its own copy of the pages it
+ * runs.
+ *
+ * Each worker takes a contiguous slice of the inputs and runs the
+ * script once per input, with the global `input` set to it: a number
+ * if the whole argument reads as one, otherwise a string. Globals are
+ * reset between inputs.
+ *
+ * Output comes back in input order: the parent passes the first
+ * worker's output straight through and holds on to the others' until
+ * the workers before them are done. */
+int runWorkers(ObjFunction* script, const char** inputs, int inputCount,
+               int workers);
+
+#endif